@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stddef.h>
+#include <assert.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -14,7 +16,7 @@
 
 #include "utils.h"
 
-//#define APU_FAST_MIXER
+static_assert(FIELD_END(Apu, dmc) <= APU_HOT_CACHE_LINES * CACHE_LINE_SIZE, "Apu per cycle state outgrew APU_HOT_CACHE_LINES");
 
 static const SequenceStep sequence_table[2][6] =
 {
@@ -91,6 +93,16 @@ bool PollApuIrqs(Apu *apu)
 
 #define FCPU 1789773.0
 
+// The channel timers are event driven: each one keeps the CPU cycle it next runs out on and is
+// only clocked then. Outputs are recomputed only after an expiry, a register write or a sequencer
+// clock, which are the only things they depend on.
+static void ApuTouchChannels(Apu *apu)
+{
+    apu->triangle_dirty = true;
+    apu->timers_dirty = true;
+    apu->mix_dirty = true;
+}
+
 static void ApuWritePulse1Duty(Apu *apu, const uint8_t data)
 {
     apu->pulse1.reg.raw = data;
@@ -414,17 +426,17 @@ static void ApuClockEnvelopes(Apu *apu)
         apu->noise.volume = apu->noise.envelope.decay_counter;
 }
 
+// Clocked every CPU cycle, the timer runs out after timer_period + 1 of them
 static void ApuClockTriangle(Apu *apu)
 {
-    if (apu->triangle.timer.raw > 0)
-        apu->triangle.timer.raw--;
-    else
-    {
-        apu->triangle.timer.raw = apu->triangle.timer_period.raw;
-        if (apu->triangle.length_counter && apu->triangle.linear_counter)
-            apu->triangle.seq_pos = (apu->triangle.seq_pos + 1) & 0x1F;
-    }
+    apu->triangle.next_clock = apu->cycles + apu->triangle.timer_period.raw + 1;
+    if (apu->triangle.length_counter && apu->triangle.linear_counter)
+        apu->triangle.seq_pos = (apu->triangle.seq_pos + 1) & 0x1F;
+    apu->triangle_dirty = true;
+}
 
+static void ApuUpdateTriangleOutput(Apu *apu)
+{
     if (apu->triangle.timer_period.raw < 2)
     {
         apu->triangle.output = 0;
@@ -433,50 +445,48 @@ static void ApuClockTriangle(Apu *apu)
     {
         apu->triangle.output = triangle_table[apu->triangle.seq_pos];
     }
+    apu->triangle_dirty = false;
+    apu->mix_dirty = true;
 }
 
 static void ApuClockDmc(Apu *apu)
 {
-    if (apu->dmc.timer > 0)
-        apu->dmc.timer--;
-    else
+    apu->dmc.next_clock = apu->cycles + apu->dmc.timer_period + 1;
+    apu->mix_dirty = true;
+    // If the silence flag is clear, the output level changes based on bit 0 of the shift register.
+    // If the bit is 1, add 2; otherwise, subtract 2.
+    // But if adding or subtracting 2 would cause the output level to leave the 0-127 range, leave the output level unchanged.
+    // This means subtract 2 only if the current level is at least 2, or add 2 only if the current level is at most 125.
+    if (!apu->dmc.silence)
     {
-        apu->dmc.timer = apu->dmc.timer_period;
-        // If the silence flag is clear, the output level changes based on bit 0 of the shift register.
-        // If the bit is 1, add 2; otherwise, subtract 2.
-        // But if adding or subtracting 2 would cause the output level to leave the 0-127 range, leave the output level unchanged.
-        // This means subtract 2 only if the current level is at least 2, or add 2 only if the current level is at most 125.
-        if (!apu->dmc.silence)
+        const uint8_t bit0 = apu->dmc.shift_reg & 1;
+        if (bit0 && apu->dmc.output_level <= 125)
         {
-            const uint8_t bit0 = apu->dmc.shift_reg & 1;
-            if (bit0 && apu->dmc.output_level <= 125)
-            {
-                apu->dmc.output_level += 2;
-            }
-            else if (!bit0 && apu->dmc.output_level >= 2)
-            {
-                apu->dmc.output_level -= 2;
-            }
+            apu->dmc.output_level += 2;
+        }
+        else if (!bit0 && apu->dmc.output_level >= 2)
+        {
+            apu->dmc.output_level -= 2;
         }
-        // The right shift register is clocked.
-        apu->dmc.shift_reg >>= 1;
+    }
+    // The right shift register is clocked.
+    apu->dmc.shift_reg >>= 1;
 
-        if (!(--apu->dmc.bits_remaining))
+    if (!(--apu->dmc.bits_remaining))
+    {
+        apu->dmc.bits_remaining = 8;
+        // Output cycle ending
+        // If the sample buffer is empty, then the silence flag is set;
+        // otherwise, the silence flag is cleared and the sample buffer is emptied into the shift register.
+        if (apu->dmc.empty)
         {
-            apu->dmc.bits_remaining = 8;
-            // Output cycle ending
-            // If the sample buffer is empty, then the silence flag is set;
-            // otherwise, the silence flag is cleared and the sample buffer is emptied into the shift register.
-            if (apu->dmc.empty)
-            {
-                apu->dmc.silence = true;
-            }
-            else
-            {
-                apu->dmc.empty = true;
-                apu->dmc.silence = false;
-                apu->dmc.shift_reg = apu->dmc.sample_buffer;
-            }
+            apu->dmc.silence = true;
+        }
+        else
+        {
+            apu->dmc.empty = true;
+            apu->dmc.silence = false;
+            apu->dmc.shift_reg = apu->dmc.sample_buffer;
         }
     }
 }
@@ -487,6 +497,7 @@ static void ApuResetFrameCounter(Apu *apu)
     apu->frame_counter.step = 0;
     apu->frame_counter.timer = 0;
     apu->frame_counter.reset = false;
+    ApuTouchChannels(apu);
 
     if (apu->frame_counter.control.seq_mode)
     {
@@ -586,6 +597,8 @@ static void ApuUpdateDmcSample(Apu *apu)
 
 void WriteAPURegister(Apu *apu, const uint16_t addr, const uint8_t data)
 {
+    ApuTouchChannels(apu);
+
     switch (addr)
     {
         case APU_PULSE_1_DUTY:
@@ -695,16 +708,44 @@ uint8_t ReadAPURegister(Apu *apu, const uint16_t addr)
     }
 }
 
+// Pulse and noise timers are clocked on put cycles, so they run out every 2 * (timer_period + 1) CPU cycles
 static void ApuClockTimers(Apu *apu)
 {
-    if (apu->pulse1.timer.raw > 0)
-        apu->pulse1.timer.raw--;
-    else
+    if (apu->cycles >= apu->pulse1.next_clock)
     {
-        apu->pulse1.timer.raw = apu->pulse1.timer_period.raw;
+        apu->pulse1.next_clock = apu->cycles + 2 * (apu->pulse1.timer_period.raw + 1);
         apu->pulse1.duty_step = (apu->pulse1.duty_step + 1) & 7;
+        apu->timers_dirty = true;
+    }
+
+    if (apu->cycles >= apu->pulse2.next_clock)
+    {
+        apu->pulse2.next_clock = apu->cycles + 2 * (apu->pulse2.timer_period.raw + 1);
+        apu->pulse2.duty_step = (apu->pulse2.duty_step + 1) & 7;
+        apu->timers_dirty = true;
     }
 
+    if (apu->cycles >= apu->noise.next_clock)
+    {
+        apu->noise.next_clock = apu->cycles + 2 * (apu->noise.timer_period.raw + 1);
+        // Clock shift reg here
+        uint16_t feedback;
+        if (apu->noise.period_reg.mode)
+        {
+            feedback = (apu->noise.shift_reg.bit0 ^ apu->noise.shift_reg.bit6);
+        }
+        else
+        {
+            feedback = (apu->noise.shift_reg.bit0 ^ apu->noise.shift_reg.bit1);
+        }
+        apu->noise.shift_reg.raw >>= 1;
+        apu->noise.shift_reg.bit14 = feedback;
+        apu->timers_dirty = true;
+    }
+
+    if (!apu->timers_dirty)
+        return;
+
     if (apu->pulse1.length_counter == 0 || apu->pulse1.muting)
     {
         apu->pulse1.output = 0;
@@ -714,65 +755,185 @@ static void ApuClockTimers(Apu *apu)
         apu->pulse1.output = duty_cycle_table[apu->pulse1.reg.duty][apu->pulse1.duty_step];
     }
 
-    if (apu->pulse2.timer.raw > 0)
-        apu->pulse2.timer.raw--;
+    if (apu->pulse2.length_counter == 0 || apu->pulse2.muting)
+    {
+        apu->pulse2.output = 0;
+    }
+    else
+    {
+        apu->pulse2.output = duty_cycle_table[apu->pulse2.reg.duty][apu->pulse2.duty_step];
+    }
+
+    if (apu->noise.length_counter == 0 || apu->noise.shift_reg.bit0)
+    {
+        apu->noise.output = 0;
+    }
     else
     {
-        apu->pulse2.timer.raw = apu->pulse2.timer_period.raw;
-        apu->pulse2.duty_step = (apu->pulse2.duty_step + 1) & 7;
+        apu->noise.output = apu->noise.volume;
     }
 
-    if (apu->pulse2.length_counter == 0 || apu->pulse2.muting)
+    apu->timers_dirty = false;
+    apu->mix_dirty = true;
+}
+
+// Nonlinear mixer lookup tables scaled to 16 bit amplitudes
+// pulse_table[n] = 95.52 / (8128 / n + 100)
+// tnd_table[3 * triangle + 2 * noise + dmc] = 163.67 / (24329 / n + 100)
+static int16_t pulse_table[31];
+static int16_t tnd_table[203];
+
+static void ApuBuildMixTables(void)
+{
+    for (int n = 1; n < (int)ARRAY_SIZE(pulse_table); n++)
+        pulse_table[n] = (int16_t)lround(95.52 / (8128.0 / n + 100.0) * 32767.0);
+
+    for (int n = 1; n < (int)ARRAY_SIZE(tnd_table); n++)
+        tnd_table[n] = (int16_t)lround(163.67 / (24329.0 / n + 100.0) * 32767.0);
+}
+
+// Split the mix into per channel shares, each group's table output is divided by how much every
+// channel contributes to the lookup index, so the shares always add up to the mix
+static void ApuMixChannels(Apu *apu, const int *levels)
+{
+    const int pulse_index = levels[APU_CHANNEL_PULSE1] + levels[APU_CHANNEL_PULSE2];
+    const int tnd_index = 3 * levels[APU_CHANNEL_TRIANGLE] + 2 * levels[APU_CHANNEL_NOISE] + levels[APU_CHANNEL_DMC];
+    const int pulse = pulse_table[pulse_index];
+    const int tnd = tnd_table[tnd_index];
+
+    if (pulse_index)
     {
-        apu->pulse2.output = 0;
+        apu->channel_amps[APU_CHANNEL_PULSE1] = pulse * levels[APU_CHANNEL_PULSE1] / pulse_index;
+        apu->channel_amps[APU_CHANNEL_PULSE2] = pulse - apu->channel_amps[APU_CHANNEL_PULSE1];
     }
     else
     {
-        apu->pulse2.output = duty_cycle_table[apu->pulse2.reg.duty][apu->pulse2.duty_step];
+        apu->channel_amps[APU_CHANNEL_PULSE1] = 0;
+        apu->channel_amps[APU_CHANNEL_PULSE2] = 0;
     }
 
-    if (apu->noise.timer.raw > 0)
-        apu->noise.timer.raw--;
+    if (tnd_index)
+    {
+        apu->channel_amps[APU_CHANNEL_TRIANGLE] = tnd * 3 * levels[APU_CHANNEL_TRIANGLE] / tnd_index;
+        apu->channel_amps[APU_CHANNEL_NOISE] = tnd * 2 * levels[APU_CHANNEL_NOISE] / tnd_index;
+        apu->channel_amps[APU_CHANNEL_DMC] = tnd - apu->channel_amps[APU_CHANNEL_TRIANGLE] - apu->channel_amps[APU_CHANNEL_NOISE];
+    }
     else
     {
-        apu->noise.timer.raw = apu->noise.timer_period.raw;
-        // Clock shift reg here
-        uint16_t feedback;
-        if (apu->noise.period_reg.mode)
+        apu->channel_amps[APU_CHANNEL_TRIANGLE] = 0;
+        apu->channel_amps[APU_CHANNEL_NOISE] = 0;
+        apu->channel_amps[APU_CHANNEL_DMC] = 0;
+    }
+}
+
+// Only hand blip a new amplitude when one of the channel levels actually changed,
+// most cycles none of them do
+static void ApuUpdateOutput(Apu *apu)
+{
+    const uint32_t key = (apu->pulse1.output * apu->pulse1.volume)
+        | (apu->pulse2.output * apu->pulse2.volume) << 4
+        | apu->triangle.output << 8
+        | apu->noise.output << 12
+        | apu->dmc.output_level << 16;
+
+    if (key == apu->levels)
+        return;
+
+    apu->levels = key;
+
+    int levels[APU_CHANNEL_COUNT] =
+    {
+        apu->pulse1.output * apu->pulse1.volume,
+        apu->pulse2.output * apu->pulse2.volume,
+        apu->triangle.output,
+        apu->noise.output,
+        apu->dmc.output_level
+    };
+
+    int amp;
+    if (apu->unity_gains && !apu->channel_mutes && !apu->stems_enabled)
+    {
+        // Common case, two table lookups
+        amp = pulse_table[levels[APU_CHANNEL_PULSE1] + levels[APU_CHANNEL_PULSE2]]
+            + tnd_table[3 * levels[APU_CHANNEL_TRIANGLE] + 2 * levels[APU_CHANNEL_NOISE] + levels[APU_CHANNEL_DMC]];
+    }
+    else
+    {
+        for (int channel = 0; channel < APU_CHANNEL_COUNT; channel++)
         {
-            feedback = (apu->noise.shift_reg.bit0 ^ apu->noise.shift_reg.bit6);
+            if (apu->channel_mutes & (1 << channel))
+                levels[channel] = 0;
         }
-        else
+
+        int previous[APU_CHANNEL_COUNT];
+        memcpy(previous, apu->channel_amps, sizeof(previous));
+        ApuMixChannels(apu, levels);
+
+        amp = 0;
+        for (int channel = 0; channel < APU_CHANNEL_COUNT; channel++)
         {
-            feedback = (apu->noise.shift_reg.bit0 ^ apu->noise.shift_reg.bit1);
+            const int channel_amp = apu->channel_amps[channel] * apu->channel_gains[channel] / APU_GAIN_UNITY;
+            amp += channel_amp;
+
+            if (apu->stems_enabled && apu->channel_amps[channel] != previous[channel])
+                BlipAddDelta(&apu->stems[channel], apu->blip_time, apu->channel_amps[channel] - previous[channel]);
         }
-        apu->noise.shift_reg.raw >>= 1;
-        apu->noise.shift_reg.bit14 = feedback;
+        amp = MIN(amp, INT16_MAX);
     }
 
-    if (apu->noise.length_counter == 0 || apu->noise.shift_reg.bit0)
-    {
-        apu->noise.output = 0;
-    }
-    else
+    BlipAddDelta(&apu->blip, apu->blip_time, amp - apu->amp);
+    apu->amp = amp;
+}
+
+// Forget everything synthesized so far and start from silence
+static void ApuClearAudio(Apu *apu)
+{
+    BlipClear(&apu->blip);
+    for (int channel = 0; channel < APU_CHANNEL_COUNT; channel++)
     {
-        apu->noise.output = apu->noise.volume;
+        BlipClear(&apu->stems[channel]);
+        apu->channel_amps[channel] = 0;
     }
+    apu->blip_time = 0;
+    apu->out_count = 0;
+    apu->levels = 0;
+    apu->amp = 0;
+    apu->mix_dirty = true;
 }
 
-static void ApuMixSample(Apu *apu)
+static void ApuEndAudioFrame(Apu *apu)
 {
-    float square1 = apu->pulse1.output * apu->pulse1.volume;
-    float square2 = apu->pulse2.output * apu->pulse2.volume;
+    // The ratio can only change between blip frames
+    const double sample_rate = apu->sample_rate * apu->rate_ratio;
 
-#ifdef APU_FAST_MIXER
-    float pulse = 0.00752f * (square1 + square2);
-    float tnd_out = 0.00851f * apu->triangle.output + 0.00494f * apu->noise.output + 0.00335f * apu->dmc.output_level;
-#else
-    float pulse = 95.88 / ((8128.0 / (square1 + square2)) + 100);
-    float tnd_out = 159.79 / (1 / ((apu->triangle.output / 8227.0) + (apu->noise.output / 12241.0) + (apu->dmc.output_level / 22638.0)) + 100);
-#endif
-    apu->mixed_sample = pulse + tnd_out;
+    BlipEndFrame(&apu->blip, apu->blip_time);
+    BlipSetRates(&apu->blip, FCPU, sample_rate);
+
+    // Nobody took the previous block, drop it rather than overflow
+    if (apu->out_count + BlipSamplesAvail(&apu->blip) > APU_OUT_BUFFER_SIZE)
+        apu->out_count = 0;
+
+    const int count = BlipReadSamples(&apu->blip, &apu->outbuffer[apu->out_count], APU_OUT_BUFFER_SIZE - apu->out_count);
+
+    // Stems run at the same rate, so they always have the same number of samples ready
+    if (apu->stems_enabled)
+    {
+        for (int channel = 0; channel < APU_CHANNEL_COUNT; channel++)
+        {
+            BlipEndFrame(&apu->stems[channel], apu->blip_time);
+            BlipSetRates(&apu->stems[channel], FCPU, sample_rate);
+            BlipReadSamples(&apu->stems[channel], &apu->stem_buffers[channel][apu->out_count], count);
+        }
+    }
+
+    const int start = apu->out_count;
+    apu->out_count += count;
+    apu->blip_time = 0;
+
+    if (apu->audio_callback)
+        apu->audio_callback(apu->audio_userdata, &apu->outbuffer[start], count);
+    else
+        NonesPutSoundData(apu);
 }
 
 void APU_Init(Apu *apu)
@@ -783,6 +944,12 @@ void APU_Init(Apu *apu)
     apu->dmc.sample_length = 1;
     apu->dmc.empty = true;
     apu->alignment = 0;
+    apu->audio_enabled = true;
+    ApuBuildMixTables();
+    for (int channel = 0; channel < APU_CHANNEL_COUNT; channel++)
+        apu->channel_gains[channel] = APU_GAIN_UNITY;
+    apu->unity_gains = true;
+    APU_SetSampleRate(apu, APU_SAMPLE_RATE, BLIP_QUALITY_MEDIUM);
 }
 
 static void ApuGetClock(Apu *apu)
@@ -802,16 +969,8 @@ static void ApuPutClock(Apu *apu)
         ApuUpdateDmcSample(apu);
     }
 
-    ApuClockTimers(apu);
-    ApuMixSample(apu);
-
-    if (apu->current_sample == 14890)
-    {
-        NonesPutSoundData(apu);
-        apu->current_sample = 0;
-    }
-
-    apu->buffer[apu->current_sample++] = apu->mixed_sample;
+    if (apu->audio_enabled)
+        ApuClockTimers(apu);
 }
 
 void APU_Tick(Apu *apu)
@@ -852,6 +1011,9 @@ void APU_Tick(Apu *apu)
                 ApuClockSweeps(apu);
             }
 
+            if (step.event != SEQ_CLOCK_NONE)
+                ApuTouchChannels(apu);
+
             if (step.frame_interrupt)
             {
                 apu->status.frame_irq |= ~apu->frame_counter.control.irq_inhibit;
@@ -860,9 +1022,17 @@ void APU_Tick(Apu *apu)
             apu->frame_counter.step = (apu->frame_counter.step + 1) % 6;
         }
 
-        ApuClockTriangle(apu);
+        if (apu->audio_enabled)
+        {
+            if (apu->cycles >= apu->triangle.next_clock)
+                ApuClockTriangle(apu);
+            if (apu->triangle_dirty)
+                ApuUpdateTriangleOutput(apu);
+        }
+        // Always clocked, the output unit decides when the sample buffer empties and so when DMA happens
         // TODO: Dmc clocking is actually done once per apu cycle, not once per cpu cycle
-        ApuClockDmc(apu);
+        if (apu->cycles >= apu->dmc.next_clock)
+            ApuClockDmc(apu);
 
         if (!((apu->cycles & 1) + apu->alignment))
         {
@@ -873,6 +1043,20 @@ void APU_Tick(Apu *apu)
             ApuPutClock(apu);
         }
 
+        if (apu->audio_enabled)
+        {
+            if (apu->mix_dirty)
+            {
+                apu->mix_dirty = false;
+                ApuUpdateOutput(apu);
+            }
+            // >= so a chunk size made smaller mid chunk closes on the next cycle
+            if (++apu->blip_time >= apu->chunk_cycles)
+            {
+                ApuEndAudioFrame(apu);
+            }
+        }
+
         apu->frame_counter.timer %= apu->frame_counter.reload;
         ++apu->frame_counter.timer;
         ++apu->cycles;
@@ -891,14 +1075,186 @@ void APU_Update(Apu *apu, uint64_t cpu_cycles)
     APU_Tick(apu);
 }
 
+// The cycle count restarts at reset, move the timer expiries along with it
+static void ApuRebaseTimers(Apu *apu)
+{
+    const uint64_t cycles = apu->cycles;
+    // Pulse and noise keep the number of put cycles they have left, the first put cycle is 1 after the rebase
+    const uint64_t put = cycles | 1;
+
+    apu->pulse1.next_clock = apu->pulse1.next_clock > put ? 1 + (apu->pulse1.next_clock - put) : 0;
+    apu->pulse2.next_clock = apu->pulse2.next_clock > put ? 1 + (apu->pulse2.next_clock - put) : 0;
+    apu->noise.next_clock = apu->noise.next_clock > put ? 1 + (apu->noise.next_clock - put) : 0;
+    apu->triangle.next_clock = apu->triangle.next_clock > cycles ? apu->triangle.next_clock - cycles : 0;
+    apu->dmc.next_clock = apu->dmc.next_clock > cycles ? apu->dmc.next_clock - cycles : 0;
+}
+
 void APU_Reset(Apu *apu)
 {
     ApuWriteStatus(apu, 0x0);
     ApuResetFrameCounter(apu);
+    ApuRebaseTimers(apu);
     apu->cycles = 0;
     apu->cycles_to_run = 0;
     apu->noise.shift_reg.raw = 1;
     apu->dmc.sample_length = 1;
     apu->dmc.empty = true;
+    ApuClearAudio(apu);
+}
+
+// Samples that are already synthesized at the old rate are dropped
+bool APU_SetSampleRate(Apu *apu, int sample_rate, BlipQuality quality)
+{
+    if (sample_rate != 44100 && sample_rate != 48000 && sample_rate != 96000)
+        return false;
+    if (quality < 0 || quality >= BLIP_QUALITY_COUNT)
+        return false;
+
+    apu->sample_rate = sample_rate;
+    APU_ResetRateControl(apu);
+    BlipInit(&apu->blip, FCPU, sample_rate, quality);
+    BlipSetFilter(&apu->blip, sample_rate, APU_HIGH_PASS1_HZ, APU_HIGH_PASS2_HZ, APU_LOW_PASS_HZ);
+    for (int channel = 0; channel < APU_CHANNEL_COUNT; channel++)
+    {
+        BlipInit(&apu->stems[channel], FCPU, sample_rate, quality);
+        BlipSetFilter(&apu->stems[channel], sample_rate, APU_HIGH_PASS1_HZ, APU_HIGH_PASS2_HZ, APU_LOW_PASS_HZ);
+    }
+    ApuClearAudio(apu);
+    APU_SetAudioChunk(apu, apu->chunk_samples);
+    return true;
+}
+
+// Dynamic rate control: the frontend reports how many samples are queued for the host after
+// each block and the resampling ratio is nudged by up to APU_RATE_MAX_ADJUST so the queue
+// settles at target_samples. A small enough change in pitch is inaudible, unlike dropped or
+// repeated blocks.
+void APU_UpdateRateControl(Apu *apu, int queued_samples, int target_samples)
+{
+    if (target_samples <= 0)
+        return;
+
+    // Smooth the fill level so the ratio doesn't follow the host's callback size
+    if (apu->rate_fill < 0.0)
+        apu->rate_fill = queued_samples;
+    else
+        apu->rate_fill += (queued_samples - apu->rate_fill) * 0.05;
+
+    const double error = (target_samples - apu->rate_fill) / target_samples;
+    apu->rate_ratio = 1.0 + APU_RATE_MAX_ADJUST * MIN(MAX(error, -1.0), 1.0);
+    // Long term average of the adjustment, which is the drift between the emulated and host clocks
+    apu->rate_drift += ((apu->rate_ratio - 1.0) - apu->rate_drift) * 0.01;
+}
+
+// Back to the nominal ratio, used when something else keeps audio and video in sync
+void APU_ResetRateControl(Apu *apu)
+{
+    apu->rate_ratio = 1.0;
+    apu->rate_fill = -1.0;
+    apu->rate_drift = 0.0;
+}
+
+// Headless runs can turn audio off. Length counters, $4015, the frame and DMC IRQs and DMC DMA
+// timing are still emulated since the CPU can observe them, the pulse/triangle/noise waveforms,
+// mixing and resampling are skipped.
+void APU_SetAudioEnabled(Apu *apu, bool enabled)
+{
+    if (enabled && !apu->audio_enabled)
+    {
+        // The waveforms were frozen, start from silence. Timers that ran out meanwhile fire right away.
+        ApuClearAudio(apu);
+        ApuTouchChannels(apu);
+    }
+    apu->audio_enabled = enabled;
+}
+
+void APU_SetChannelMute(Apu *apu, ApuChannel channel, bool muted)
+{
+    if (channel >= APU_CHANNEL_COUNT)
+        return;
+
+    apu->channel_mutes = (apu->channel_mutes & ~(1 << channel)) | (muted << channel);
+    // Force a remix on the next cycle
+    apu->levels = UINT32_MAX;
+    apu->mix_dirty = true;
 }
 
+void APU_SetChannelGain(Apu *apu, ApuChannel channel, int gain)
+{
+    if (channel >= APU_CHANNEL_COUNT)
+        return;
+
+    apu->channel_gains[channel] = MIN(MAX(gain, 0), APU_GAIN_MAX);
+
+    apu->unity_gains = true;
+    for (int i = 0; i < APU_CHANNEL_COUNT; i++)
+        apu->unity_gains &= apu->channel_gains[i] == APU_GAIN_UNITY;
+    apu->levels = UINT32_MAX;
+    apu->mix_dirty = true;
+}
+
+// Stems start from silence at the next block, the main mix isn't affected
+void APU_SetStemsEnabled(Apu *apu, bool enabled)
+{
+    if (enabled && !apu->stems_enabled)
+    {
+        for (int channel = 0; channel < APU_CHANNEL_COUNT; channel++)
+        {
+            BlipClear(&apu->stems[channel]);
+            // Line the stem up with the main buffer's sample grid so both produce the same counts
+            apu->stems[channel].factor = apu->blip.factor;
+            apu->stems[channel].offset = apu->blip.offset;
+            apu->channel_amps[channel] = 0;
+            memset(apu->stem_buffers[channel], 0, sizeof(apu->stem_buffers[channel]));
+        }
+        apu->levels = UINT32_MAX;
+        apu->mix_dirty = true;
+    }
+    apu->stems_enabled = enabled;
+}
+
+void APU_SetAudioCallback(Apu *apu, ApuAudioCallback callback, void *userdata)
+{
+    apu->audio_callback = callback;
+    apu->audio_userdata = userdata;
+}
+
+// Deliver audio every samples output samples instead of once per frame, so the host can run
+// with a buffer smaller than a frame. 0 goes back to APU_FRAME_CYCLES.
+void APU_SetAudioChunk(Apu *apu, int samples)
+{
+    if (samples <= 0)
+    {
+        apu->chunk_samples = 0;
+        apu->chunk_cycles = APU_FRAME_CYCLES;
+    }
+    else
+    {
+        // A chunk must still fit in the blip buffer at the highest rate adjustment
+        apu->chunk_samples = MIN(MAX(samples, APU_MIN_CHUNK_SAMPLES), APU_OUT_BUFFER_SIZE / 2);
+        apu->chunk_cycles = (uint32_t)ceil(apu->chunk_samples * FCPU / apu->sample_rate);
+    }
+}
+
+// Only the emulated APU, the output settings stay the session's and audio restarts from silence
+void APU_StateSync(Apu *apu, State *state)
+{
+    STATE_FIELD(state, apu->cycles);
+    STATE_FIELD(state, apu->prev_cpu_cycles);
+    STATE_FIELD(state, apu->cycles_to_run);
+    STATE_FIELD(state, apu->pulse1);
+    STATE_FIELD(state, apu->pulse2);
+    STATE_FIELD(state, apu->triangle);
+    STATE_FIELD(state, apu->noise);
+    STATE_FIELD(state, apu->dmc);
+    STATE_FIELD(state, apu->frame_counter);
+    STATE_FIELD(state, apu->status);
+    STATE_FIELD(state, apu->alignment);
+    STATE_FIELD(state, apu->delay);
+    STATE_FIELD(state, apu->frame);
+
+    if (state->loading)
+    {
+        ApuClearAudio(apu);
+        ApuTouchChannels(apu);
+    }
+}
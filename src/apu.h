@@ -1,6 +1,28 @@
 #ifndef APU_H
 #define APU_H
 
+#include "blip.h"
+#include "state.h"
+
+// Default output rate, 48000 and 96000 are supported as well
+#define APU_SAMPLE_RATE 44100
+#define APU_MAX_SAMPLE_RATE 96000
+// CPU cycles between two blocks of samples handed to the frontend unless a chunk size is set
+#define APU_FRAME_CYCLES 29780
+// Smallest chunk APU_SetAudioChunk accepts, in output samples
+#define APU_MIN_CHUNK_SAMPLES 16
+// Most the resampling ratio is nudged away from nominal by rate control
+#define APU_RATE_MAX_ADJUST 0.005
+// The console's output stage: two first order high-pass filters and a first order low-pass
+#define APU_HIGH_PASS1_HZ 90.0
+#define APU_HIGH_PASS2_HZ 440.0
+#define APU_LOW_PASS_HZ 14000.0
+// Unity gain for APU_SetChannelGain, gains are 8.8 fixed point
+#define APU_GAIN_UNITY 256
+#define APU_GAIN_MAX (APU_GAIN_UNITY * 2)
+// Room for a few blocks in case the consumer falls behind
+#define APU_OUT_BUFFER_SIZE 4096
+
 typedef struct
 {
     uint16_t counter;
@@ -155,22 +177,55 @@ typedef union
     };
 } ApuDmcControl;
 
-typedef struct
+typedef enum
 {
-    float buffer[14890];
-    int16_t outbuffer[735];
+    APU_CHANNEL_PULSE1,
+    APU_CHANNEL_PULSE2,
+    APU_CHANNEL_TRIANGLE,
+    APU_CHANNEL_NOISE,
+    APU_CHANNEL_DMC,
+    APU_CHANNEL_COUNT
+} ApuChannel;
 
+// Receives every chunk of samples as soon as it is synthesized
+typedef void (*ApuAudioCallback)(void *userdata, const int16_t *samples, int count);
+
+// Per cycle state comes first and fits in APU_HOT_CACHE_LINES cache lines. The mix settings
+// are only read when the mix is redone, the output settings and the sample buffers (over
+// 100 KiB with the stems) go last.
+typedef struct
+{
     uint64_t cycles;
     int64_t prev_cpu_cycles;
     int32_t cycles_to_run;
+    // CPU cycles since the current blip frame started
+    uint32_t blip_time;
+    uint32_t chunk_cycles;
+    // Packed channel levels and the amplitude last handed to blip
+    uint32_t levels;
+    int amp;
+    int alignment;
+    int delay;
+    // When clear only CPU visible state is emulated, no samples are produced
+    bool audio_enabled;
+    // Set when a channel output has to be recomputed, or the mix redone
+    bool triangle_dirty;
+    bool timers_dirty;
+    bool mix_dirty;
+    //int clear_frame_irq_delay;
+    //bool clear_frame_irq;
+    bool frame;
+
+    ApuFrameCounter frame_counter;
+    ApuStatus status;
 
     struct {
         ApuPulseReg reg;
         ApuPulseSweepReg sweep_reg;
         // External
         ApuTimer timer_period;
-        // Internal timer
-        ApuTimer timer;
+        // CPU cycle the internal timer next runs out on
+        uint64_t next_clock;
         ApuEnvelope envelope;
         uint16_t freq;
         bool reload;
@@ -188,7 +243,7 @@ typedef struct
         ApuPulseReg reg;
         ApuPulseSweepReg sweep_reg;
         ApuTimer timer_period;
-        ApuTimer timer;
+        uint64_t next_clock;
         ApuEnvelope envelope;
         uint16_t freq;
         bool reload;
@@ -205,7 +260,7 @@ typedef struct
     struct {
         ApuTriangleLinearCounter reg;
         ApuTimer timer_period;
-        ApuTimer timer;
+        uint64_t next_clock;
         uint16_t seq_pos;
         bool reload;
         uint16_t output;
@@ -220,7 +275,7 @@ typedef struct
         ApuNoisePeriodReg period_reg;
         ApuNoiseShiftReg shift_reg;
         ApuTimer timer_period;
-        ApuTimer timer;
+        uint64_t next_clock;
         uint16_t volume;
         uint16_t output;
         uint16_t length_counter;
@@ -230,7 +285,7 @@ typedef struct
     struct {
         ApuDmcControl control;
         uint16_t timer_period;
-        uint16_t timer;
+        uint64_t next_clock;
         uint16_t sample_addr;
         uint16_t sample_length;
         uint8_t sample_buffer;
@@ -245,18 +300,36 @@ typedef struct
         uint8_t output_level : 7;
     } dmc;
 
-    ApuFrameCounter frame_counter;
-    ApuStatus status;
+    // Each channel's share of the mix, and the gain (APU_GAIN_UNITY = 1.0) it is mixed with.
+    // Muted channels are left out of the nonlinear mix entirely.
+    int channel_amps[APU_CHANNEL_COUNT];
+    int channel_gains[APU_CHANNEL_COUNT];
+    uint8_t channel_mutes;
+    bool unity_gains;
+    // Optional per channel output, stem_buffers use the same out_count as outbuffer
+    bool stems_enabled;
 
-    float mixed_sample;
-    int alignment;
-    int delay;
-    //int clear_frame_irq_delay;
-    int current_sample;
-    //bool clear_frame_irq;
-    bool frame;
+    // Cold
+    int out_count;
+    int sample_rate;
+    // Chunks go to audio_callback when set, NonesPutSoundData otherwise
+    ApuAudioCallback audio_callback;
+    void *audio_userdata;
+    // 0 for one chunk per APU_FRAME_CYCLES
+    int chunk_samples;
+    // Dynamic rate control, see APU_UpdateRateControl
+    double rate_ratio;
+    double rate_fill;
+    double rate_drift;
+    BlipBuffer blip;
+    BlipBuffer stems[APU_CHANNEL_COUNT];
+    // Samples ready for the frontend, the consumer resets out_count after taking them
+    int16_t outbuffer[APU_OUT_BUFFER_SIZE];
+    int16_t stem_buffers[APU_CHANNEL_COUNT][APU_OUT_BUFFER_SIZE];
 } Apu;
 
+#define APU_HOT_CACHE_LINES 5
+
 typedef enum 
 {
     SEQ_CLOCK_NONE,
@@ -307,5 +380,15 @@ void APU_Init(Apu *apu);
 void APU_Update(Apu *apu, uint64_t cpu_cycles);
 void APU_Tick(Apu *apu);
 void APU_Reset(Apu *apu);
+bool APU_SetSampleRate(Apu *apu, int sample_rate, BlipQuality quality);
+void APU_UpdateRateControl(Apu *apu, int queued_samples, int target_samples);
+void APU_ResetRateControl(Apu *apu);
+void APU_SetAudioEnabled(Apu *apu, bool enabled);
+void APU_SetChannelMute(Apu *apu, ApuChannel channel, bool muted);
+void APU_SetChannelGain(Apu *apu, ApuChannel channel, int gain);
+void APU_SetStemsEnabled(Apu *apu, bool enabled);
+void APU_SetAudioCallback(Apu *apu, ApuAudioCallback callback, void *userdata);
+void APU_SetAudioChunk(Apu *apu, int samples);
+void APU_StateSync(Apu *apu, State *state);
 
 #endif
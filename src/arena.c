@@ -1,3 +1,8 @@
+#ifndef _WIN32
+// MAP_ANONYMOUS and madvise
+#define _DEFAULT_SOURCE
+#endif
+
 #include <assert.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -5,43 +10,206 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <stdalign.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "arena.h"
 #include "utils.h"
 
-static const size_t ALIGN = alignof(max_align_t);
+static const size_t BLOCK_HEADER_SIZE = (sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+static size_t ArenaPageSize(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static void *ArenaMapPages(size_t size, bool huge)
+{
+#ifdef _WIN32
+    if (huge)
+    {
+        // Needs the lock pages privilege, quietly falls back without it
+        const size_t large_page = GetLargePageMinimum();
+        if (large_page && !(size % large_page))
+        {
+            void *pages = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (pages)
+                return pages;
+        }
+    }
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void *pages = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    // Only succeeds with huge pages reserved up front
+    if (huge)
+        pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (pages == MAP_FAILED)
+    {
+        // Transparent huge pages instead, which only back huge page aligned ranges. Map a huge
+        // page more than needed and trim both ends to the alignment.
+        const size_t slack = huge ? ARENA_HUGE_PAGE_SIZE : 0;
+        uint8_t *raw = mmap(NULL, size + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            return NULL;
 
-Arena *ArenaCreate(size_t bytes)
+        uint8_t *aligned = huge ? (uint8_t *)(((uintptr_t)raw + slack - 1) & ~(uintptr_t)(slack - 1)) : raw;
+        if (aligned > raw)
+            munmap(raw, aligned - raw);
+        if (raw + size + slack > aligned + size)
+            munmap(aligned + size, raw + size + slack - (aligned + size));
+        pages = aligned;
+#ifdef MADV_HUGEPAGE
+        if (huge)
+            madvise(pages, size, MADV_HUGEPAGE);
+#endif
+    }
+    return pages;
+#endif
+}
+
+static void ArenaUnmapPages(void *pages, size_t size)
+{
+#ifdef _WIN32
+    UNUSED(size);
+    VirtualFree(pages, 0, MEM_RELEASE);
+#else
+    munmap(pages, size);
+#endif
+}
+
+// A block with room for at least capacity bytes of pushes, which come out zeroed
+static bool ArenaAddBlock(Arena *arena, size_t capacity)
+{
+    const bool huge = arena->flags & ARENA_HUGE_PAGES;
+    const size_t page = huge ? ARENA_HUGE_PAGE_SIZE : ArenaPageSize();
+    const size_t mapped = (BLOCK_HEADER_SIZE + capacity + page - 1) & ~(page - 1);
+
+    ArenaBlock *block = ArenaMapPages(mapped, huge);
+    if (!block)
+        return false;
+
+    block->prev = arena->block;
+    block->size = 0;
+    block->capacity = mapped - BLOCK_HEADER_SIZE;
+    block->mapped = mapped;
+    arena->block = block;
+    arena->reserved += mapped;
+    return true;
+}
+
+static void ArenaFreeBlock(Arena *arena)
+{
+    ArenaBlock *block = arena->block;
+    arena->block = block->prev;
+    arena->used -= block->size;
+    arena->reserved -= block->mapped;
+    ArenaUnmapPages(block, block->mapped);
+}
+
+// The first block holds bytes exactly, more are added as needed. NULL if out of memory.
+Arena *ArenaCreate(size_t bytes, ArenaFlags flags)
 {
     Arena *arena = calloc(1, sizeof(*arena));
-    arena->heap = calloc(1, bytes);
-    arena->size = 0;
-    arena->capacity = bytes;
+    if (!arena)
+        return NULL;
+
+    arena->flags = flags;
+    if (bytes && !ArenaAddBlock(arena, bytes))
+    {
+        free(arena);
+        return NULL;
+    }
 
     return arena;
 }
 
+// What a push of bytes takes from the arena, for sizing it up front
+size_t ArenaPushSize(size_t bytes)
+{
+    return (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// Make sure the next bytes worth of pushes (see ArenaPushSize) fit without growing again
+bool ArenaReserve(Arena *arena, size_t bytes)
+{
+    if (arena->block && arena->block->capacity - arena->block->size >= bytes)
+        return true;
+
+    return ArenaAddBlock(arena, bytes);
+}
+
+// Zeroed memory aligned to ARENA_ALIGN, NULL if out of memory
 void *ArenaPush(Arena *arena, size_t bytes)
 {
-    size_t padded_size = (bytes + ALIGN - 1) & ~(ALIGN - 1);
-    assert((arena->size + padded_size) < arena->capacity);
+    const size_t padded_size = ArenaPushSize(bytes);
+    if ((!arena->block || arena->block->capacity - arena->block->size < padded_size)
+        && !ArenaAddBlock(arena, MAX(padded_size, ARENA_MIN_BLOCK_SIZE)))
+        return NULL;
 
-    void *ptr = &arena->heap[arena->size];
+    ArenaBlock *block = arena->block;
+    uint8_t *ptr = (uint8_t *)block + BLOCK_HEADER_SIZE + block->size;
     DEBUG_LOG("Adding a %zd byte block to the arena\n", padded_size);
 
-    arena->size += padded_size;
+    block->size += padded_size;
+    arena->used += padded_size;
+    arena->high_water = MAX(arena->high_water, arena->used);
 
+    // Fresh pages are zero already, memory given back by a rollback isn't
+    memset(ptr, 0, bytes);
     return ptr;
 }
 
+ArenaMark ArenaGetMark(const Arena *arena)
+{
+    ArenaMark mark = { arena->block, arena->block ? arena->block->size : 0, arena->used };
+    return mark;
+}
+
+// Drops everything pushed since mark, blocks added since are unmapped
+void ArenaRollback(Arena *arena, ArenaMark mark)
+{
+    while (arena->block != mark.block)
+    {
+        assert(arena->block);
+        ArenaFreeBlock(arena);
+    }
+
+    if (arena->block)
+        arena->block->size = mark.size;
+    arena->used = mark.used;
+}
+
+// Everything goes but the first block
 void ArenaClear(Arena *arena)
 {
-    arena->size = 0;
+    while (arena->block && arena->block->prev)
+        ArenaFreeBlock(arena);
+
+    if (arena->block)
+        arena->block->size = 0;
+    arena->used = 0;
 }
 
 void ArenaDestroy(Arena *arena)
 {
-    free(arena->heap);
+    if (!arena)
+        return;
+
+    while (arena->block)
+        ArenaFreeBlock(arena);
     free(arena);
 }
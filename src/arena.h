@@ -1,15 +1,59 @@
 #ifndef ARENA_H
 #define ARENA_H
 
-typedef struct
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Every push starts on its own cache line
+#define ARENA_ALIGN 64
+// Smallest block the arena grows by when a push doesn't fit
+#define ARENA_MIN_BLOCK_SIZE 0x10000
+#define ARENA_HUGE_PAGE_SIZE 0x200000
+
+typedef enum
 {
-    uint8_t *heap;
+    ARENA_DEFAULT = 0,
+    // Round every block up to ARENA_HUGE_PAGE_SIZE and back it with huge pages when the system
+    // allows it, the system and a cart then share a single block
+    ARENA_HUGE_PAGES = 1 << 0,
+} ArenaFlags;
+
+// Page aligned chunk of memory, pushes are carved from the newest one
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *prev;
     size_t size;
     size_t capacity;
+    // Bytes mapped, including this header
+    size_t mapped;
+} ArenaBlock;
+
+typedef struct
+{
+    ArenaBlock *block;
+    ArenaFlags flags;
+    // Bytes pushed, bytes mapped and the most that was ever pushed at once
+    size_t used;
+    size_t reserved;
+    size_t high_water;
 } Arena;
 
-Arena *ArenaCreate(size_t bytes);
+// Where the arena was, everything pushed after it goes with ArenaRollback
+typedef struct
+{
+    ArenaBlock *block;
+    size_t size;
+    size_t used;
+} ArenaMark;
+
+Arena *ArenaCreate(size_t bytes, ArenaFlags flags);
 void *ArenaPush(Arena *arena, size_t bytes);
+size_t ArenaPushSize(size_t bytes);
+bool ArenaReserve(Arena *arena, size_t bytes);
+ArenaMark ArenaGetMark(const Arena *arena);
+void ArenaRollback(Arena *arena, ArenaMark mark);
+void ArenaClear(Arena *arena);
 void ArenaDestroy(Arena *arena);
 
 #endif
@@ -0,0 +1,237 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <stdalign.h>
+
+#include "blip.h"
+#include "utils.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLIP_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+typedef struct
+{
+    int width;
+    // Fraction of the output Nyquist rate that is passed
+    double cutoff;
+} BlipTier;
+
+static const BlipTier blip_tiers[BLIP_QUALITY_COUNT] =
+{
+    { 8,  0.75 },
+    { 16, 0.90 },
+    { 32, 0.95 },
+};
+
+// Band-limited impulse for every phase, each tap is stored next to the same tap of the
+// following phase so both can be weighted in a single multiply-add
+static alignas(16) int16_t blip_kernels[BLIP_QUALITY_COUNT][BLIP_PHASE_COUNT][BLIP_MAX_WIDTH * 2];
+static bool kernels_ready;
+
+static void BlipBuildPhase(int16_t *taps_out, int width, double cutoff, int phase)
+{
+    const double half_width = width / 2;
+    double taps[BLIP_MAX_WIDTH];
+    double sum = 0.0;
+
+    for (int n = 0; n < width; n++)
+    {
+        // Impulse sits between the two middle taps depending on the phase
+        const double x = n - (half_width - 1) - (double)phase / BLIP_PHASE_COUNT;
+        const double angle = M_PI * x * cutoff;
+        const double sinc = fabs(angle) < 1e-9 ? 1.0 : sin(angle) / angle;
+        // Blackman window
+        const double window = 0.42 + 0.5 * cos(M_PI * x / half_width) + 0.08 * cos(2.0 * M_PI * x / half_width);
+
+        taps[n] = fabs(x) < half_width ? sinc * window : 0.0;
+        sum += taps[n];
+    }
+
+    // Each phase has to add up to exactly one unit or the integrator would drift
+    int total = 0;
+    int peak = 0;
+    for (int n = 0; n < width; n++)
+    {
+        taps_out[n] = (int16_t)lround(taps[n] * BLIP_DELTA_UNIT / sum);
+        total += taps_out[n];
+        if (taps_out[n] > taps_out[peak])
+            peak = n;
+    }
+    taps_out[peak] += BLIP_DELTA_UNIT - total;
+}
+
+static void BlipBuildKernels(void)
+{
+    if (kernels_ready)
+        return;
+
+    for (int quality = 0; quality < BLIP_QUALITY_COUNT; quality++)
+    {
+        const BlipTier *tier = &blip_tiers[quality];
+
+        // The extra phase lets us interpolate past the last one
+        int16_t phases[BLIP_PHASE_COUNT + 1][BLIP_MAX_WIDTH];
+        for (int phase = 0; phase <= BLIP_PHASE_COUNT; phase++)
+            BlipBuildPhase(phases[phase], tier->width, tier->cutoff, phase);
+
+        for (int phase = 0; phase < BLIP_PHASE_COUNT; phase++)
+        {
+            for (int n = 0; n < tier->width; n++)
+            {
+                blip_kernels[quality][phase][n * 2] = phases[phase][n];
+                blip_kernels[quality][phase][n * 2 + 1] = phases[phase + 1][n];
+            }
+        }
+    }
+
+    kernels_ready = true;
+}
+
+void BlipInit(BlipBuffer *blip, double clock_rate, double sample_rate, BlipQuality quality)
+{
+    BlipBuildKernels();
+
+    blip->quality = quality;
+    blip->width = blip_tiers[quality].width;
+    BlipSetRates(blip, clock_rate, sample_rate);
+    blip->filter.enabled = false;
+    BlipClear(blip);
+}
+
+void BlipSetRates(BlipBuffer *blip, double clock_rate, double sample_rate)
+{
+    // Round up so a frame never produces fewer samples than expected
+    blip->factor = (uint64_t)ceil(sample_rate / clock_rate * (double)(1ULL << BLIP_TIME_BITS));
+}
+
+void BlipClear(BlipBuffer *blip)
+{
+    blip->offset = blip->factor / 2;
+    blip->avail = 0;
+    blip->integrator = 0;
+    blip->filter.high_pass1_in = 0.0f;
+    blip->filter.high_pass1_out = 0.0f;
+    blip->filter.high_pass2_in = 0.0f;
+    blip->filter.high_pass2_out = 0.0f;
+    blip->filter.low_pass_out = 0.0f;
+    memset(blip->samples, 0, sizeof(blip->samples));
+}
+
+void BlipSetFilter(BlipBuffer *blip, double sample_rate, double high_pass1, double high_pass2, double low_pass)
+{
+    const double dt = 1.0 / sample_rate;
+
+    // y[n] = a * (y[n-1] + x[n] - x[n-1]) with a = RC / (RC + dt), a = 1 passes everything through
+    const double rc1 = high_pass1 > 0.0 ? 1.0 / (2.0 * M_PI * high_pass1) : 0.0;
+    const double rc2 = high_pass2 > 0.0 ? 1.0 / (2.0 * M_PI * high_pass2) : 0.0;
+    blip->filter.high_pass1 = high_pass1 > 0.0 ? (float)(rc1 / (rc1 + dt)) : 1.0f;
+    blip->filter.high_pass2 = high_pass2 > 0.0 ? (float)(rc2 / (rc2 + dt)) : 1.0f;
+
+    // y[n] = y[n-1] + b * (x[n] - y[n-1]) with b = dt / (RC + dt), b = 1 passes everything through
+    const double rc3 = low_pass > 0.0 ? 1.0 / (2.0 * M_PI * low_pass) : 0.0;
+    blip->filter.low_pass = (float)(dt / (rc3 + dt));
+
+    blip->filter.enabled = high_pass1 > 0.0 || high_pass2 > 0.0 || low_pass > 0.0;
+}
+
+// Add an amplitude change at time clocks from the start of the current frame
+void BlipAddDelta(BlipBuffer *blip, uint32_t time, int delta)
+{
+    const uint64_t fixed = time * blip->factor + blip->offset;
+    int32_t *out = &blip->samples[blip->avail + (fixed >> BLIP_TIME_BITS)];
+
+    const int phase = (fixed >> (BLIP_TIME_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASE_COUNT - 1);
+    const int interp = (fixed >> (BLIP_TIME_BITS - BLIP_PHASE_BITS - BLIP_DELTA_BITS)) & (BLIP_DELTA_UNIT - 1);
+
+    // Split the delta between the two closest kernel phases
+    const int delta2 = (delta * interp) >> BLIP_DELTA_BITS;
+    const int delta1 = delta - delta2;
+
+    const int16_t *kernel = blip_kernels[blip->quality][phase];
+
+    assert(out + blip->width <= &blip->samples[ARRAY_SIZE(blip->samples)]);
+
+#ifdef BLIP_USE_SSE2
+    // Every 32 bit lane of the multiply-add is tap * delta1 + next_tap * delta2
+    const __m128i deltas = _mm_set1_epi32((int32_t)((uint32_t)(uint16_t)delta1 | (uint32_t)(uint16_t)delta2 << 16));
+    for (int n = 0; n < blip->width; n += 4)
+    {
+        const __m128i taps = _mm_load_si128((const __m128i *)&kernel[n * 2]);
+        __m128i sum = _mm_loadu_si128((const __m128i *)&out[n]);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(taps, deltas));
+        _mm_storeu_si128((__m128i *)&out[n], sum);
+    }
+#else
+    for (int n = 0; n < blip->width; n++)
+        out[n] += kernel[n * 2] * delta1 + kernel[n * 2 + 1] * delta2;
+#endif
+}
+
+// Make the samples up to time clocks available for reading and start a new frame there
+void BlipEndFrame(BlipBuffer *blip, uint32_t time)
+{
+    const uint64_t off = time * blip->factor + blip->offset;
+    blip->avail += off >> BLIP_TIME_BITS;
+    blip->offset = off & ((1ULL << BLIP_TIME_BITS) - 1);
+
+    assert(blip->avail <= BLIP_MAX_SAMPLES);
+}
+
+int BlipSamplesAvail(const BlipBuffer *blip)
+{
+    return blip->avail;
+}
+
+int BlipReadSamples(BlipBuffer *blip, int16_t *out, int count)
+{
+    count = MIN(count, blip->avail);
+
+    int32_t sum = blip->integrator;
+    if (!blip->filter.enabled)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            const int32_t s = MIN(MAX(sum >> BLIP_DELTA_BITS, INT16_MIN), INT16_MAX);
+            sum += blip->samples[i];
+            out[i] = (int16_t)s;
+            // Leak a little of the integrator every sample to remove DC
+            sum -= s << (BLIP_DELTA_BITS - BLIP_BASS_SHIFT);
+        }
+    }
+    else
+    {
+        // The filters run in the same pass as the integrator, samples are only touched once
+        BlipFilter f = blip->filter;
+        for (int i = 0; i < count; i++)
+        {
+            const float x = (float)(sum >> BLIP_DELTA_BITS);
+            sum += blip->samples[i];
+
+            f.high_pass1_out = f.high_pass1 * (f.high_pass1_out + x - f.high_pass1_in);
+            f.high_pass1_in = x;
+            f.high_pass2_out = f.high_pass2 * (f.high_pass2_out + f.high_pass1_out - f.high_pass2_in);
+            f.high_pass2_in = f.high_pass1_out;
+            f.low_pass_out += f.low_pass * (f.high_pass2_out - f.low_pass_out);
+
+            out[i] = (int16_t)MIN(MAX(lrintf(f.low_pass_out), INT16_MIN), INT16_MAX);
+        }
+        blip->filter = f;
+    }
+    blip->integrator = sum;
+
+    // Shift the unread samples and the tail of pending deltas down
+    const int remain = blip->avail + blip->width + 2 - count;
+    memmove(blip->samples, &blip->samples[count], remain * sizeof(int32_t));
+    memset(&blip->samples[remain], 0, count * sizeof(int32_t));
+    blip->avail -= count;
+
+    return count;
+}
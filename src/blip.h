@@ -0,0 +1,80 @@
+#ifndef BLIP_H
+#define BLIP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Band-limited step synthesis in the style of blip_buf.
+// Amplitude changes are added as deltas at a clock timestamp, each delta is spread over
+// up to BLIP_MAX_WIDTH output samples with a windowed sinc kernel and integrated on read.
+// The fractional sample position carries over between frames, so frames don't need to
+// line up with output samples.
+
+// Most samples that can be held between two reads
+#define BLIP_MAX_SAMPLES 4096
+// Kernel taps per delta for the widest quality tier
+#define BLIP_MAX_WIDTH 32
+// Sub-sample positions of the kernel (2^BLIP_PHASE_BITS)
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASE_COUNT (1 << BLIP_PHASE_BITS)
+// Fixed point precision of the kernel, every kernel phase sums to BLIP_DELTA_UNIT
+#define BLIP_DELTA_BITS 15
+#define BLIP_DELTA_UNIT (1 << BLIP_DELTA_BITS)
+// Fractional bits of the clock to sample position factor
+#define BLIP_TIME_BITS 32
+// Integrator leak that removes DC when no output filter is set
+#define BLIP_BASS_SHIFT 9
+
+typedef enum
+{
+    // 8 taps
+    BLIP_QUALITY_LOW,
+    // 16 taps
+    BLIP_QUALITY_MEDIUM,
+    // 32 taps, flattest passband
+    BLIP_QUALITY_HIGH,
+    BLIP_QUALITY_COUNT
+} BlipQuality;
+
+// First order high-pass/low-pass chain run on the samples as they are integrated
+typedef struct
+{
+    bool enabled;
+    float high_pass1;
+    float high_pass2;
+    float low_pass;
+    // Filter state
+    float high_pass1_in;
+    float high_pass1_out;
+    float high_pass2_in;
+    float high_pass2_out;
+    float low_pass_out;
+} BlipFilter;
+
+typedef struct
+{
+    BlipQuality quality;
+    int width;
+    // Output samples per clock in BLIP_TIME_BITS fixed point
+    uint64_t factor;
+    // Fractional sample position where the current frame starts
+    uint64_t offset;
+    int avail;
+    int32_t integrator;
+    BlipFilter filter;
+    int32_t samples[BLIP_MAX_SAMPLES + BLIP_MAX_WIDTH + 2];
+} BlipBuffer;
+
+void BlipInit(BlipBuffer *blip, double clock_rate, double sample_rate, BlipQuality quality);
+void BlipClear(BlipBuffer *blip);
+// Change the resampling ratio, only between frames
+void BlipSetRates(BlipBuffer *blip, double clock_rate, double sample_rate);
+// delta has to fit in 16 bits
+void BlipAddDelta(BlipBuffer *blip, uint32_t time, int delta);
+// Cutoffs in Hz, a zero high-pass cutoff skips that stage. With no filter set the DC leak is used.
+void BlipSetFilter(BlipBuffer *blip, double sample_rate, double high_pass1, double high_pass2, double low_pass);
+void BlipEndFrame(BlipBuffer *blip, uint32_t time);
+int BlipSamplesAvail(const BlipBuffer *blip);
+int BlipReadSamples(BlipBuffer *blip, int16_t *out, int count);
+
+#endif
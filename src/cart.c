@@ -1,18 +1,310 @@
+#ifndef _WIN32
+// mmap, msync, open, fstat, ftruncate and flock
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "arena.h"
 #include "cart.h"
 #include "mapper.h"
 
-static void CartLoadSram(Cart *cart)
+// Every image currently in use, guarded by rom_cache_lock
+static RomImage *rom_cache;
+static atomic_flag rom_cache_lock = ATOMIC_FLAG_INIT;
+
+// Reflected CRC32 with the 0xEDB88320 polynomial, one entry per byte value
+static const uint32_t crc32_table[256] =
+{
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D,
+};
+
+// Start with a crc of 0, pass the previous result to continue a checksum
+uint32_t CartCrc32(uint32_t crc, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = (crc >> 8) ^ crc32_table[(crc ^ bytes[i]) & 0xFF];
+
+    return ~crc;
+}
+
+static int CartMapImage(RomImage *image, const char *path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return -1;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || !size.QuadPart)
+    {
+        CloseHandle(file);
+        return -1;
+    }
+
+    // The view keeps the file and the mapping alive, both handles can go
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return -1;
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!data)
+        return -1;
+
+    image->data = data;
+    image->size = (size_t)size.QuadPart;
+#else
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) || !st.st_size)
+    {
+        close(fd);
+        return -1;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+
+    image->data = data;
+    image->size = st.st_size;
+#endif
+    return 0;
+}
+
+static void CartUnmapImage(RomImage *image)
+{
+    if (!image->data)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(image->data);
+#else
+    munmap((void *)image->data, image->size);
+#endif
+    image->data = NULL;
+    image->size = 0;
+}
+
+static void RomCacheLock(void)
+{
+    while (atomic_flag_test_and_set_explicit(&rom_cache_lock, memory_order_acquire))
+        ;
+}
+
+static void RomCacheUnlock(void)
+{
+    atomic_flag_clear_explicit(&rom_cache_lock, memory_order_release);
+}
+
+// Hands back the cached image with the same ROM contents as mapped, dropping mapped,
+// or moves mapped into the cache. NULL if out of memory.
+static RomImage *RomCacheAcquire(RomImage *mapped)
+{
+    RomCacheLock();
+
+    for (RomImage *image = rom_cache; image; image = image->next)
+    {
+        // The CRC narrows it down, the compare makes sure
+        if (image->crc32 == mapped->crc32 && image->rom_size == mapped->rom_size
+            && !memcmp(&image->data[image->rom_offset], &mapped->data[mapped->rom_offset], mapped->rom_size))
+        {
+            image->refs++;
+            RomCacheUnlock();
+            CartUnmapImage(mapped);
+            return image;
+        }
+    }
+
+    RomImage *image = malloc(sizeof(*image));
+    if (image)
+    {
+        *image = *mapped;
+        image->refs = 1;
+        image->next = rom_cache;
+        rom_cache = image;
+    }
+
+    RomCacheUnlock();
+    return image;
+}
+
+static void RomCacheRelease(RomImage *image)
+{
+    RomCacheLock();
+
+    if (--image->refs)
+    {
+        RomCacheUnlock();
+        return;
+    }
+
+    for (RomImage **link = &rom_cache; *link; link = &(*link)->next)
+    {
+        if (*link == image)
+        {
+            *link = image->next;
+            break;
+        }
+    }
+
+    RomCacheUnlock();
+    CartUnmapImage(image);
+    free(image);
+}
+
+// Back cart->ram with a shared read/write mapping of the save file. Whatever part of
+// CART_RAM_SIZE the file doesn't have yet is taken from the RAM as it is now.
+// 1 if another process already has the file mapped, -1 on failure.
+static int CartMapSram(Cart *cart)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(cart->save_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return -1;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        return -1;
+    }
+
+    // Grows the file to CART_RAM_SIZE if it's shorter
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, CART_RAM_SIZE, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return -1;
+
+    uint8_t *ram = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, CART_RAM_SIZE);
+    CloseHandle(mapping);
+    if (!ram)
+        return -1;
+
+    const size_t have = size.QuadPart < CART_RAM_SIZE ? (size_t)size.QuadPart : CART_RAM_SIZE;
+#else
+    const int fd = open(cart->save_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return -1;
+
+    // Two sessions of the same game would see each other's writes mid-frame, only one gets
+    // the mapping. The lock goes with the descriptor in CartDetachSram.
+    if (flock(fd, LOCK_EX | LOCK_NB))
+    {
+        close(fd);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || (st.st_size < CART_RAM_SIZE && ftruncate(fd, CART_RAM_SIZE)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    uint8_t *ram = mmap(NULL, CART_RAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ram == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    cart->ram_fd = fd;
+
+    const size_t have = st.st_size < CART_RAM_SIZE ? (size_t)st.st_size : CART_RAM_SIZE;
+#endif
+    memcpy(&ram[have], &cart->ram[have], CART_RAM_SIZE - have);
+
+    cart->ram = ram;
+    cart->ram_mapped = true;
+    return 0;
+}
+
+static void CartAttachSram(Cart *cart)
 {
-    char save_path[256];
-    snprintf(save_path, sizeof(save_path), "%s.sav", cart->name);
-    FILE *sav = fopen(save_path, "rb");
+    cart->ram_dirty = false;
+    cart->ram_sync_frames = 0;
+
+    if (!cart->battery || !cart->save_path[0])
+        return;
+
+    const int result = CartMapSram(cart);
+    if (!result)
+        return;
+
+    // Can't be mapped, keep the RAM in the arena and only write it out on CartSaveSram
+    if (result > 0)
+        fprintf(stderr, "%s is in use by another session, battery RAM is only saved on exit!\n", cart->save_path);
+    else
+        fprintf(stderr, "Failed to map %s, battery RAM is only saved on exit!\n", cart->save_path);
+    FILE *sav = fopen(cart->save_path, "rb");
     if (sav)
     {
         fread(cart->ram, CART_RAM_SIZE, 1, sav);
@@ -20,36 +312,100 @@ static void CartLoadSram(Cart *cart)
     }
 }
 
-int CartLoad(Arena *arena, Cart *cart, const char *path)
+// Flushes and drops the mapping, cart->ram goes back to the arena copy with the same contents
+static void CartDetachSram(Cart *cart)
 {
-    FILE *fp = fopen(path, "rb");
-    if (!fp)
+    if (!cart->ram_mapped)
+        return;
+
+    memcpy(cart->ram_buffer, cart->ram, CART_RAM_SIZE);
+#ifdef _WIN32
+    FlushViewOfFile(cart->ram, CART_RAM_SIZE);
+    UnmapViewOfFile(cart->ram);
+#else
+    msync(cart->ram, CART_RAM_SIZE, MS_SYNC);
+    munmap(cart->ram, CART_RAM_SIZE);
+    close(cart->ram_fd);
+#endif
+    cart->ram = cart->ram_buffer;
+    cart->ram_mapped = false;
+}
+
+// The path minus its extension, the caller's string is left alone
+static void CartSetName(Cart *cart, const char *path)
+{
+    snprintf(cart->name, sizeof(cart->name), "%s", path);
+
+    char *dot = strrchr(cart->name, '.');
+    char *slash = strrchr(cart->name, '/');
+    char *backslash = strrchr(cart->name, '\\');
+    // Only an extension if no separator comes after it
+    if (dot && (!slash || dot > slash) && (!backslash || dot > backslash))
+        *dot = '\0';
+}
+
+// save_path is where battery RAM is kept, NULL for the .sav next to the ROM
+int CartLoad(Arena *arena, Cart *cart, const char *path, const char *save_path)
+{
+    CartUnload(cart);
+
+    RomImage mapped = { 0 };
+    if (CartMapImage(&mapped, path))
     {
         fprintf(stderr, "Failed to open %s!\n", path);
         return -1;
     }
 
-    NES2_Header hdr;
-    fread(&hdr, 1, HEADER_SIZE, fp);
+    const uint8_t *file = mapped.data;
 
     // iNES / NES2 header magic
     const char magic[4] = { 0x4E, 0x45, 0x53, 0x1A };
 
-    if (memcmp(magic, hdr.id_string, 4))
+    if (mapped.size < HEADER_SIZE || memcmp(magic, file, 4))
     {
         fprintf(stderr, "Not a valid iNES/NES2 file format!\n");
-        fclose(fp);
+        CartUnmapImage(&mapped);
+        return -1;
+    }
+
+    NES2_Header hdr;
+    memcpy(&hdr, file, HEADER_SIZE);
+
+    // Old rippers wrote tags like "DiskDude!" over bytes 7-15, if an iNES header has anything
+    // in bytes 12-15 byte 7 can't be trusted either
+    const bool nes2 = hdr.nes2_id == 2;
+    if (!nes2 && (file[12] | file[13] | file[14] | file[15]))
+        hdr.mapper_number_d7d4 = 0;
+
+    const uint32_t prg_size = hdr.prg_rom_size_lsb * 0x4000;
+    const uint32_t chr_size = hdr.chr_rom_size_lsb * 0x2000;
+    const size_t rom_offset = HEADER_SIZE + hdr.trainer_area_512 * TRAINER_SIZE;
+
+    if (mapped.size < rom_offset + prg_size + chr_size)
+    {
+        fprintf(stderr, "%s is truncated, expected %u bytes of PRG and %u of CHR!\n", path, prg_size, chr_size);
+        CartUnmapImage(&mapped);
         return -1;
     }
 
-    const int mapper_number = hdr.mapper_number_d7d4 << 4 | hdr.mapper_number_d3d0;
+    mapped.rom_offset = rom_offset;
+    mapped.rom_size = prg_size + chr_size;
+    mapped.crc32 = CartCrc32(0, &file[rom_offset], mapped.rom_size);
+    cart->crc32 = mapped.crc32;
+    // TODO: Correct known bad headers from a CRC32 keyed database (mapper, mirroring, battery),
+    // only with checksums verified against the actual dumps
+
+    int mapper_number = hdr.mapper_number_d7d4 << 4 | hdr.mapper_number_d3d0;
+    cart->mirroring = hdr.name_table_layout;
+    cart->battery = hdr.battery;
 
     printf("Loading %s\n", path);
-    printf("ID String: %s\n", hdr.id_string);
+    printf("ID String: %.3s\n", hdr.id_string);
+    printf("CRC32: %08X\n", cart->crc32);
     printf("PRG Rom Size in 16 KiB units: %d\n", hdr.prg_rom_size_lsb);
     printf("CHR Rom Size in 8 KiB units: %d\n", hdr.chr_rom_size_lsb);
-    printf("Nametable layout: %d\n", hdr.name_table_layout);
-    printf("Battery: %d\n", hdr.battery);
+    printf("Nametable layout: %d\n", cart->mirroring);
+    printf("Battery: %d\n", cart->battery);
     printf("Trainer: %d\n", hdr.trainer_area_512);
     printf("Alt nametable layout: %d\n", hdr.alt_name_tables);
     printf("Mapper: %d\n", mapper_number);
@@ -68,76 +424,169 @@ int CartLoad(Arena *arena, Cart *cart, const char *path)
             break;
         default:
             printf("Mapper %d is not supported yet!\n", mapper_number);
+            CartUnmapImage(&mapped);
             return -1;
     }
 
-    fseek(fp, HEADER_SIZE, SEEK_END);
-    uint32_t rom_size = ftell(fp);
-    uint8_t *rom = malloc(rom_size);
+    // The header tells exactly what the cart needs, the pushes below can't fail after this
+    if (!ArenaReserve(arena, ArenaPushSize(CART_RAM_SIZE) + (chr_size ? 0 : ArenaPushSize(CHR_RAM_SIZE))))
+    {
+        fprintf(stderr, "Out of memory loading %s!\n", path);
+        CartUnmapImage(&mapped);
+        return -1;
+    }
 
-    char *base_name = strrchr(path, '/');
-    char *filename = base_name ? base_name : (char*)path;
+    // Another cart may already have these contents mapped, only use the shared copy from here on
+    cart->image = RomCacheAcquire(&mapped);
+    if (!cart->image)
+    {
+        fprintf(stderr, "Out of memory loading %s!\n", path);
+        CartUnmapImage(&mapped);
+        return -1;
+    }
+    file = cart->image->data;
+    const size_t shared_offset = cart->image->rom_offset;
 
-    cart->name = strtok(filename, ".");
+    CartSetName(cart, path);
 
-    cart->prg_rom.size = hdr.prg_rom_size_lsb * 0x4000;
-    cart->prg_rom.mask = cart->prg_rom.size - 1;
-    cart->chr_rom.size = hdr.chr_rom_size_lsb * 0x2000;
-    cart->mirroring = hdr.name_table_layout;
-    cart->battery = hdr.battery;
     cart->mapper_num = mapper_number;
+    cart->prg_rom.size = prg_size;
+    cart->prg_rom.mask = cart->prg_rom.size - 1;
+    cart->prg_rom.data = &file[shared_offset];
 
-    cart->prg_rom.data = ArenaPush(arena, cart->prg_rom.size);
-
-    const uint16_t trainer_offset = hdr.trainer_area_512 * 512;
-
-    fseek(fp, HEADER_SIZE + trainer_offset, SEEK_SET);
-    fread(rom, rom_size, 1, fp);
-
-    memcpy(cart->prg_rom.data, rom, cart->prg_rom.size);
-
-    if (cart->chr_rom.size)
+    if (chr_size)
     {
-        cart->chr_rom.data = ArenaPush(arena, cart->chr_rom.size);
-        memcpy(cart->chr_rom.data, &rom[cart->prg_rom.size], cart->chr_rom.size);
+        cart->chr_rom.size = chr_size;
+        cart->chr_rom.data = &file[shared_offset + prg_size];
+        cart->chr_rom.ram = NULL;
     }
     else
     {
         // Chr rom size is 0, assume it's chr ram with a size of 8kib
         printf("Using chr ram\n");
-        cart->chr_rom.data = ArenaPush(arena, CHR_RAM_SIZE);
+        cart->chr_rom.ram = ArenaPush(arena, CHR_RAM_SIZE);
+        memset(cart->chr_rom.ram, 0, CHR_RAM_SIZE);
+        cart->chr_rom.data = cart->chr_rom.ram;
         cart->chr_rom.size = CHR_RAM_SIZE;
-        cart->chr_rom.is_ram = true;  
     }
 
     // Sram / Wram
-    cart->ram = ArenaPush(arena, CART_RAM_SIZE);
-
-    // Load Sram
-    if (cart->battery)
-    {
-        CartLoadSram(cart);
-    }
+    cart->ram_buffer = ArenaPush(arena, CART_RAM_SIZE);
+    memset(cart->ram_buffer, 0, CART_RAM_SIZE);
+    cart->ram = cart->ram_buffer;
 
-    fclose(fp);
-    free(rom);
+    if (save_path)
+        snprintf(cart->save_path, sizeof(cart->save_path), "%s", save_path);
+    else
+        snprintf(cart->save_path, sizeof(cart->save_path), "%s.sav", cart->name);
+    CartAttachSram(cart);
 
     MapperInit(cart);
     return 0;
 }
 
-void CartSaveSram(Cart *cart)
+// PRG and CHR ROM are gone afterwards, the image itself once no other cart uses it
+void CartUnload(Cart *cart)
+{
+    CartDetachSram(cart);
+    if (cart->image)
+        RomCacheRelease(cart->image);
+    cart->image = NULL;
+    cart->prg_rom.data = NULL;
+    cart->chr_rom.data = NULL;
+}
+
+// Moves battery RAM to another file. An existing save there is loaded, otherwise the
+// current RAM is carried over to it.
+int CartSetSavePath(Cart *cart, const char *save_path)
+{
+    if (!strcmp(cart->save_path, save_path))
+        return 0;
+
+    CartDetachSram(cart);
+    snprintf(cart->save_path, sizeof(cart->save_path), "%s", save_path);
+    CartAttachSram(cart);
+    return 0;
+}
+
+// Battery RAM is kept in memory only until a save path is set again, for a process that
+// must not write to the save it was started with
+void CartForgetSavePath(Cart *cart)
+{
+    CartDetachSram(cart);
+    cart->save_path[0] = '\0';
+}
+
+// Call once a frame. Battery RAM the game has changed is queued for writing about once a
+// second, the kernel only writes the pages that were touched.
+void CartSyncSram(Cart *cart)
 {
-    if (cart->battery)
+    if (!cart->ram_dirty || ++cart->ram_sync_frames < CART_SRAM_SYNC_FRAMES)
+        return;
+
+    cart->ram_dirty = false;
+    cart->ram_sync_frames = 0;
+
+    if (cart->ram_mapped)
     {
-        char save_path[128];
-        snprintf(save_path, sizeof(save_path), "%s.sav", cart->name);
+#ifdef _WIN32
+        FlushViewOfFile(cart->ram, CART_RAM_SIZE);
+#else
+        msync(cart->ram, CART_RAM_SIZE, MS_ASYNC);
+#endif
+    }
+}
 
-        FILE *sav = fopen(save_path, "wb");
-        if (sav != NULL)
-        {
-            fwrite(cart->ram, CART_RAM_SIZE, 1, sav);
-            fclose(sav);
-        }
+// Writes battery RAM out now, 0 on success. Unmapped RAM goes to a temporary file first
+// so a crash halfway leaves the previous save intact.
+int CartSaveSram(Cart *cart)
+{
+    if (!cart->battery || !cart->save_path[0])
+        return 0;
+
+    if (cart->ram_mapped)
+    {
+#ifdef _WIN32
+        return FlushViewOfFile(cart->ram, CART_RAM_SIZE) ? 0 : -1;
+#else
+        return msync(cart->ram, CART_RAM_SIZE, MS_SYNC);
+#endif
+    }
+
+    char temp_path[CART_SAVE_PATH_SIZE + 4];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", cart->save_path);
+
+    FILE *sav = fopen(temp_path, "wb");
+    if (!sav)
+        return -1;
+
+    const bool written = fwrite(cart->ram, CART_RAM_SIZE, 1, sav) == 1;
+    if (fclose(sav) || !written)
+    {
+        remove(temp_path);
+        return -1;
     }
+
+#ifdef _WIN32
+    if (!MoveFileExA(temp_path, cart->save_path, MOVEFILE_REPLACE_EXISTING))
+#else
+    if (rename(temp_path, cart->save_path))
+#endif
+    {
+        remove(temp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Work RAM and CHR RAM, a loaded battery RAM goes out with the next sync
+void CartStateSync(Cart *cart, State *state)
+{
+    StateBytes(state, cart->ram, CART_RAM_SIZE);
+    if (cart->chr_rom.ram)
+        StateBytes(state, cart->chr_rom.ram, CHR_RAM_SIZE);
+
+    if (state->loading)
+        cart->ram_dirty = true;
 }
@@ -4,8 +4,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "arena.h"
+#include "state.h"
 
 #define HEADER_SIZE 16
+#define TRAINER_SIZE 512
+#define CART_NAME_SIZE 256
+// The name plus ".sav"
+#define CART_SAVE_PATH_SIZE (CART_NAME_SIZE + 4)
+// Frames between write backs of a changed battery RAM mapping
+#define CART_SRAM_SYNC_FRAMES 60
 
 typedef struct
 {
@@ -41,7 +48,7 @@ typedef struct
 
 typedef struct
 {
-    uint8_t *data;
+    const uint8_t *data;
     uint32_t size;
     uint32_t mask;
     // Number of banks depending on the bank size;
@@ -50,11 +57,26 @@ typedef struct
 
 typedef struct
 {
-    uint8_t *data;
+    const uint8_t *data;
     uint32_t size;
-    bool is_ram;
+    // Writable CHR RAM, NULL when data points into the ROM image
+    uint8_t *ram;
 } ChrRom;
 
+// A ROM file mapped read-only, PRG and CHR ROM point straight into it.
+// Images are refcounted and shared by every cart in the process loaded from the same contents.
+typedef struct RomImage
+{
+    const uint8_t *data;
+    size_t size;
+    // PRG + CHR ROM, and their CRC32
+    size_t rom_offset;
+    size_t rom_size;
+    uint32_t crc32;
+    int refs;
+    struct RomImage *next;
+} RomImage;
+
 typedef union
 {
     uint8_t raw : 5;
@@ -248,24 +270,46 @@ typedef struct
 } BnRom;
 
 typedef struct Cart {
+    RomImage *image;
     PrgRom prg_rom;
     ChrRom chr_rom;
-    // WRAM or SRAM
+    // WRAM or SRAM, a shared mapping of save_path for battery carts when it could be mapped
     uint8_t *ram;
+    uint8_t *ram_buffer;
     int mapper_num;
     int mem_map;
     int mirroring;
-    const char *name;
+    // ROM path without the extension
+    char name[CART_NAME_SIZE];
+    // Battery RAM file, the .sav next to the ROM unless the frontend picks one
+    char save_path[CART_SAVE_PATH_SIZE];
+    bool ram_mapped;
+    // Save file kept open for its lock while mapped, POSIX only
+    int ram_fd;
+    // Set on writes to ram, see CartSyncSram
+    bool ram_dirty;
+    int ram_sync_frames;
+    // CRC32 of PRG and CHR ROM
+    uint32_t crc32;
     bool battery;
-    uint8_t (*PrgReadFn)(struct Cart *cart, const uint16_t addr);
-    uint8_t (*ChrReadFn)(struct Cart *cart, const uint16_t addr);
-    void (*RegWriteFn)(const uint16_t addr, const uint8_t data);
+    // CPU $8000-$FFFF in 8 KiB slots and PPU $0000-$1FFF in 1 KiB slots,
+    // the mappers repoint them when a bank register is written
+    const uint8_t *prg_slots[4];
+    const uint8_t *chr_slots[8];
 } Cart;
 
 #define CART_RAM_SIZE 0x2000
 #define CHR_RAM_SIZE 0x2000
+#define PRG_SLOT_SIZE 0x2000
+#define CHR_SLOT_SIZE 0x400
 
-int CartLoad(Arena *arena, Cart *cart, const char *path);
-void CartSaveSram(Cart *cart);
+int CartLoad(Arena *arena, Cart *cart, const char *path, const char *save_path);
+void CartUnload(Cart *cart);
+int CartSetSavePath(Cart *cart, const char *save_path);
+void CartForgetSavePath(Cart *cart);
+void CartSyncSram(Cart *cart);
+int CartSaveSram(Cart *cart);
+void CartStateSync(Cart *cart, State *state);
+uint32_t CartCrc32(uint32_t crc, const void *data, size_t size);
 
 #endif
@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stddef.h>
+#include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,6 +17,9 @@
 #include "system.h"
 #include "utils.h"
 
+// The hot registers have to stay in the first cache line of Cpu
+static_assert(FIELD_END(Cpu, irq_pending) <= CACHE_LINE_SIZE, "Cpu registers span more than one cache line");
+
 //#define DISABLE_DUMMY_READ_WRITES
 
 static uint8_t CpuRead8(const uint16_t addr)
@@ -1880,3 +1885,17 @@ void CPU_Reset(Cpu *cpu)
     // Reset cycles
     cpu->cycles = 7;
 }
+
+void CPU_StateSync(Cpu *cpu, State *state)
+{
+    STATE_FIELD(state, cpu->cycles);
+    STATE_FIELD(state, cpu->pc);
+    STATE_FIELD(state, cpu->a);
+    STATE_FIELD(state, cpu->x);
+    STATE_FIELD(state, cpu->y);
+    STATE_FIELD(state, cpu->sp);
+    STATE_FIELD(state, cpu->status);
+    STATE_FIELD(state, cpu->nmi_pin);
+    STATE_FIELD(state, cpu->nmi_pending);
+    STATE_FIELD(state, cpu->irq_pending);
+}
@@ -1,6 +1,8 @@
 #ifndef CPU_H
 #define CPU_H
 
+#include "state.h"
+
 typedef enum
 {
     Accumulator,
@@ -48,9 +50,9 @@ typedef union
     };
 } Flags;
 
+// Registers first, every instruction touches them and they share one cache line
 typedef struct
 {
-    char debug_msg[128];
     uint64_t cycles;
     uint16_t pc;
     uint8_t a;
@@ -61,6 +63,9 @@ typedef struct
     uint8_t nmi_pin;
     bool nmi_pending;
     bool irq_pending;
+
+    // Cold
+    char debug_msg[128];
 } Cpu;
 
 typedef struct
@@ -93,5 +98,6 @@ typedef struct
 void CPU_Init(Cpu *cpu);
 void CPU_Update(Cpu *cpu, bool debug_info);
 void CPU_Reset(Cpu *cpu);
+void CPU_StateSync(Cpu *cpu, State *state);
 
 #endif
@@ -0,0 +1,92 @@
+#ifdef __linux__
+// fork, sockets and sigaction
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "forkserver.h"
+#include "utils.h"
+
+#ifdef __linux__
+
+// Listens on a Unix socket at socket_path and forks a child for every connection. The child
+// carries on with a copy on write image of the process and gets the connection back, the client
+// first reads the child's pid from it as 4 bytes in host order. The parent never returns unless
+// the socket fails, -1 then.
+int ForkServerRun(const char *socket_path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    const size_t length = strlen(socket_path);
+    if (length >= sizeof(addr.sun_path))
+        return -1;
+    memcpy(addr.sun_path, socket_path, length + 1);
+
+    const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0)
+        return -1;
+
+    // A server that went away leaves its socket file behind
+    unlink(socket_path);
+    if (bind(server, (struct sockaddr *)&addr, sizeof(addr)) || listen(server, FORK_SERVER_BACKLOG))
+    {
+        fprintf(stderr, "Fork server can't listen on %s: %s\n", socket_path, strerror(errno));
+        close(server);
+        return -1;
+    }
+
+    // Children are reaped by the kernel
+    struct sigaction action = { .sa_handler = SIG_IGN };
+    struct sigaction previous;
+    sigaction(SIGCHLD, &action, &previous);
+
+    for (;;)
+    {
+        const int conn = accept(server, NULL, NULL);
+        if (conn < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+
+        // On a failed fork the client just sees the connection close
+        if (!fork())
+        {
+            close(server);
+            sigaction(SIGCHLD, &previous, NULL);
+
+            const uint32_t pid = (uint32_t)getpid();
+            if (write(conn, &pid, sizeof(pid)) != sizeof(pid))
+                _exit(1);
+            return conn;
+        }
+        close(conn);
+    }
+
+    fprintf(stderr, "Fork server stopped: %s\n", strerror(errno));
+    sigaction(SIGCHLD, &previous, NULL);
+    close(server);
+    return -1;
+}
+
+#else
+
+int ForkServerRun(const char *socket_path)
+{
+    UNUSED(socket_path);
+    fprintf(stderr, "The fork server is only available on Linux\n");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef FORKSERVER_H
+#define FORKSERVER_H
+
+// Connections the kernel queues while a child is being forked
+#define FORK_SERVER_BACKLOG 64
+
+int ForkServerRun(const char *socket_path);
+
+#endif
@@ -26,264 +26,129 @@ static const uint16_t mmc1_chr_bank_sizes[2] =
     0x2000, 0x1000
 };
 
-static uint8_t NromReadPrgRom(Cart *cart, uint16_t addr)
-{
-    return cart->prg_rom.data[addr & cart->prg_rom.mask];
-}
-
 static inline int GetNumPrgRomBanks(const uint32_t prg_rom_size, const uint16_t bank_size)
 {
     return prg_rom_size / bank_size;
 }
 
-static inline uint32_t GetPrgBankAddr(const int bank, const uint16_t addr, const uint16_t bank_size, const uint32_t prg_rom_mask)
-{
-    return ((bank * bank_size) + (addr & (bank_size - 1))) & prg_rom_mask;
-}
-
-// Prg bank mode 0 & 1: switch 32 KB at $8000, ignoring low bit of bank number;
-static uint8_t Mmc1PrgReadMode01(Cart *cart, int bank, const uint16_t addr)
-{
-    uint32_t final_addr = GetPrgBankAddr(bank, addr, PRG_BANK_SIZE_32KIB, cart->prg_rom.mask);
-    //printf("0, 1, Reading from addr: 0x%X\n", final_addr);
-    return cart->prg_rom.data[final_addr];
-}
-
-// Prg bank mode 2: fix first bank at $8000 and switch 16 KB bank at $C000;
-static uint8_t Mmc1PrgReadMode2(Cart *cart, int bank, const uint16_t addr)
+// Point the 8 KiB slots covering a bank_size window at cpu_addr to bank
+static void MapPrg(Cart *cart, const uint16_t cpu_addr, const int bank, const uint32_t bank_size)
 {
-    switch ((addr >> 13) & 0x3)
+    for (uint32_t offset = 0; offset < bank_size; offset += PRG_SLOT_SIZE)
     {
-        case 0:
-        case 1:
-        {
-            uint32_t final_addr = GetPrgBankAddr(0, addr, PRG_BANK_SIZE_16KIB, cart->prg_rom.mask);
-            //printf("Mmc1 mode 2: 0, 1, Reading from addr: 0x%X\n", final_addr);
-            return cart->prg_rom.data[final_addr];
-        }
-        case 2:
-        case 3:
-        {
-            uint32_t final_addr = GetPrgBankAddr(bank, addr, PRG_BANK_SIZE_16KIB, cart->prg_rom.mask);
-            //printf("Mmc1 mode 2: 2, 3, Reading from addr: 0x%X\n", final_addr);
-            return cart->prg_rom.data[final_addr];
-        }
+        const int slot = ((cpu_addr + offset) >> 13) & 0x3;
+        cart->prg_slots[slot] = &cart->prg_rom.data[((bank * bank_size) + offset) & cart->prg_rom.mask];
     }
-
-    return 0;
 }
 
-// Prg bank mode 3: fix last bank at $C000 and switch 16 KB bank at $8000);
-static uint8_t Mmc1PrgReadMode3(Cart *cart, int bank, const uint16_t addr)
+// Point the 1 KiB slots covering a bank_size window at ppu_addr to bank
+static void MapChr(Cart *cart, const uint16_t ppu_addr, const int bank, const uint32_t bank_size)
 {
-    switch ((addr >> 13) & 0x3)
+    for (uint32_t offset = 0; offset < bank_size; offset += CHR_SLOT_SIZE)
     {
-        case 0:
-        case 1:
-        {
-            uint32_t final_addr = GetPrgBankAddr(bank, addr, PRG_BANK_SIZE_16KIB, cart->prg_rom.mask);
-            //printf("0, 1, Reading from addr: 0x%X\n", final_addr);
-            return cart->prg_rom.data[final_addr];
-        }
-        case 2:
-        case 3:
-        {
-            uint32_t final_addr = GetPrgBankAddr(cart->prg_rom.num_banks - 1, addr, PRG_BANK_SIZE_16KIB, cart->prg_rom.mask); 
-            //printf("2, 3, Reading from addr: 0x%X\n", final_addr);
-            return cart->prg_rom.data[final_addr];
-        }
+        const int slot = ((ppu_addr + offset) >> 10) & 0x7;
+        cart->chr_slots[slot] = &cart->chr_rom.data[((bank * bank_size) + offset) & (cart->chr_rom.size - 1)];
     }
-
-    return 0;
 }
 
-static uint8_t Mmc3ReadPrgRom(Cart *cart, const uint16_t addr)
+static void NromUpdateBanks(Cart *cart)
 {
-    if (mmc3.bank_sel.prg_rom_bank_mode)
-    {
-        switch ((addr >> 13) & 0x3)
-        {
-            case 0:
-            {
-                // Read from second to last bank
-                uint32_t final_addr = GetPrgBankAddr(cart->prg_rom.num_banks - 2, addr, PRG_BANK_SIZE_8KIB, cart->prg_rom.mask);
-                //printf("0i, Reading from addr: 0x%X\n", final_addr);
-                return cart->prg_rom.data[final_addr];
-            }
-            case 1:
-            {
-                uint32_t final_addr = GetPrgBankAddr(mmc3.regs[7], addr, PRG_BANK_SIZE_8KIB, cart->prg_rom.mask);
-                //printf("1i, Reading from addr: 0x%X\n", final_addr);
-                return cart->prg_rom.data[final_addr];
-            }
-
-            case 2:
-            {
-                uint32_t final_addr = GetPrgBankAddr(mmc3.regs[6], addr, PRG_BANK_SIZE_8KIB, cart->prg_rom.mask);
-                //printf("2i, Reading from addr: 0x%X\n", final_addr);
-                return cart->prg_rom.data[final_addr];
-            }
-            case 3:
-            {
-                // Read from the last bank
-                uint32_t final_addr = GetPrgBankAddr(cart->prg_rom.num_banks - 1, addr, PRG_BANK_SIZE_8KIB, cart->prg_rom.mask);
-                //printf("3i, Reading from addr: 0x%X\n", final_addr);
-                return cart->prg_rom.data[final_addr];
-            }
-        }
-    }
-
-    switch ((addr >> 13) & 0x3)
-    {
-        case 0:
-        {
-            uint32_t final_addr = GetPrgBankAddr(mmc3.regs[6], addr, PRG_BANK_SIZE_8KIB, cart->prg_rom.mask);
-            //printf("0, Reading from addr: 0x%X\n", final_addr);
-            return cart->prg_rom.data[final_addr];
-        }
-        case 1:
-        {
-            uint32_t final_addr = GetPrgBankAddr(mmc3.regs[7], addr, PRG_BANK_SIZE_8KIB, cart->prg_rom.mask);
-            //printf("1, Reading from addr: 0x%X\n", final_addr);
-            return cart->prg_rom.data[final_addr];
-        }
-
-        case 2:
-        {
-            uint32_t final_addr = GetPrgBankAddr(cart->prg_rom.num_banks - 2, addr, PRG_BANK_SIZE_8KIB, cart->prg_rom.mask);
-            //printf("2, Reading from addr: 0x%X\n", final_addr);
-            return cart->prg_rom.data[final_addr];
-        }
-        case 3:
-        {
-            uint32_t final_addr = GetPrgBankAddr(cart->prg_rom.num_banks - 1, addr, PRG_BANK_SIZE_8KIB, cart->prg_rom.mask);
-            //printf("3, Reading from addr: 0x%X\n", final_addr);
-            return cart->prg_rom.data[final_addr];
-        }
-    }
-
-    return 0;
+    MapPrg(cart, 0x8000, 0, PRG_BANK_SIZE_32KIB);
+    MapChr(cart, 0x0000, 0, 0x2000);
 }
 
-static uint8_t Mmc1ReadPrgRom(Cart *cart, const uint16_t addr)
+static void Mmc1UpdateBanks(Cart *cart)
 {
-    // Should this be in BusRead instead?
-    mmc1.consec_write = false;
-
     switch (mmc1.control.prg_rom_bank_mode)
     {
+        // Prg bank mode 0 & 1: switch 32 KB at $8000, ignoring low bit of bank number;
         case 0:
         case 1:
-            return Mmc1PrgReadMode01(cart, mmc1.prg_bank.select >> 1, addr);
+            MapPrg(cart, 0x8000, mmc1.prg_bank.select >> 1, PRG_BANK_SIZE_32KIB);
+            break;
+        // Prg bank mode 2: fix first bank at $8000 and switch 16 KB bank at $C000;
         case 2:
-            return Mmc1PrgReadMode2(cart, mmc1.prg_bank.select, addr);
+            MapPrg(cart, 0x8000, 0, PRG_BANK_SIZE_16KIB);
+            MapPrg(cart, 0xC000, mmc1.prg_bank.select, PRG_BANK_SIZE_16KIB);
+            break;
+        // Prg bank mode 3: fix last bank at $C000 and switch 16 KB bank at $8000);
         case 3:
-            return Mmc1PrgReadMode3(cart, mmc1.prg_bank.select, addr);
+            MapPrg(cart, 0x8000, mmc1.prg_bank.select, PRG_BANK_SIZE_16KIB);
+            MapPrg(cart, 0xC000, cart->prg_rom.num_banks - 1, PRG_BANK_SIZE_16KIB);
+            break;
     }
 
-    return 0;
-}
-
-static uint8_t UxRomReadPrgRom(Cart *cart, const uint16_t addr)
-{
-    // UxROM prg reads are just like mmc1's prg mode 3
-    return Mmc1PrgReadMode3(cart, ux_rom.bank & 0x7, addr);
-}
+    const uint32_t bank_size = mmc1_chr_bank_sizes[mmc1.control.chr_rom_bank_mode];
+    // Select chr bank (5-bit value, max 32 banks), ignore low bit in 8 Kib mode
+    int bank0 = mmc1.chr_bank0 >> !mmc1.control.chr_rom_bank_mode;
+    int bank1 = mmc1.chr_bank1;
 
-static uint8_t AxRomReadPrgRom(Cart *cart, const uint16_t addr)
-{
-    const uint32_t final_addr = GetPrgBankAddr(ax_rom.bank, addr, PRG_BANK_SIZE_32KIB, cart->prg_rom.mask);
-    return cart->prg_rom.data[final_addr];
-}
+    // If CHR is only 8 KiB, the bank number is ANDed with 1
+    if (cart->chr_rom.size == 0x2000)
+    {
+        bank0 &= 1;
+        bank1 &= 1;
+    }
 
-static uint8_t ColorDreamsReadPrgRom(Cart *cart, const uint16_t addr)
-{
-    const uint32_t final_addr = GetPrgBankAddr(color_dreams.prg_bank, addr, PRG_BANK_SIZE_32KIB, cart->prg_rom.mask);
-    return cart->prg_rom.data[final_addr];
+    MapChr(cart, 0x0000, bank0, bank_size);
+    if (mmc1.control.chr_rom_bank_mode)
+        MapChr(cart, 0x1000, bank1, bank_size);
 }
 
-static uint8_t NinjaReadPrgRom(Cart *cart, const uint16_t addr)
+static void Mmc3UpdateBanks(Cart *cart)
 {
-    const uint32_t final_addr = GetPrgBankAddr(ninja.prg_bank, addr, PRG_BANK_SIZE_32KIB, cart->prg_rom.mask);
-    return cart->prg_rom.data[final_addr];
-}
+    // The fixed second to last bank and R6 swap places in prg mode 1
+    const int second_last = cart->prg_rom.num_banks - 2;
+    MapPrg(cart, 0x8000, mmc3.bank_sel.prg_rom_bank_mode ? second_last : mmc3.regs[6], PRG_BANK_SIZE_8KIB);
+    MapPrg(cart, 0xA000, mmc3.regs[7], PRG_BANK_SIZE_8KIB);
+    MapPrg(cart, 0xC000, mmc3.bank_sel.prg_rom_bank_mode ? mmc3.regs[6] : second_last, PRG_BANK_SIZE_8KIB);
+    MapPrg(cart, 0xE000, cart->prg_rom.num_banks - 1, PRG_BANK_SIZE_8KIB);
 
-static uint8_t BnRomReadPrgRom(Cart *cart, const uint16_t addr)
-{
-    const uint32_t final_addr = GetPrgBankAddr(bn_rom.bank, addr, PRG_BANK_SIZE_32KIB, cart->prg_rom.mask);
-    return cart->prg_rom.data[final_addr];
+    // R0 and R1 are 2 KiB banks, R2-R5 1 KiB banks, A12 inversion swaps the two halves
+    const uint16_t invert = mmc3.bank_sel.chr_a12_invert * 0x1000;
+    MapChr(cart, 0x0000 ^ invert, mmc3.regs[0], 0x800);
+    MapChr(cart, 0x0800 ^ invert, mmc3.regs[1], 0x800);
+    for (int reg = 2; reg < 6; reg++)
+        MapChr(cart, (0x1000 + (reg - 2) * 0x400) ^ invert, mmc3.regs[reg], 0x400);
 }
 
-static uint8_t NromReadChrRom(Cart *cart, const uint16_t addr)
+static void UxRomUpdateBanks(Cart *cart)
 {
-    return cart->chr_rom.data[addr & (cart->chr_rom.size - 1)];
+    // UxROM prg banking is just like mmc1's prg mode 3
+    MapPrg(cart, 0x8000, ux_rom.bank & 0x7, PRG_BANK_SIZE_16KIB);
+    MapPrg(cart, 0xC000, cart->prg_rom.num_banks - 1, PRG_BANK_SIZE_16KIB);
+    MapChr(cart, 0x0000, 0, 0x2000);
 }
 
-static uint8_t Mmc1ReadChrRom(Cart *cart, const uint16_t addr)
+static void CnRomUpdateBanks(Cart *cart)
 {
-    uint32_t bank_size = mmc1_chr_bank_sizes[mmc1.control.chr_rom_bank_mode];
-
-    // Select chr bank (5-bit value, max 32 banks)
-    uint32_t bank = (addr < 0x1000 || !mmc1.control.chr_rom_bank_mode) ? mmc1.chr_bank0 : mmc1.chr_bank1;
-
-    // Ignore low bit in 8 Kib mode
-    bank >>= !mmc1.control.chr_rom_bank_mode;
-
-    // If CHR is only 8 KiB, the bank number is ANDed with 1
-    if (cart->chr_rom.size == 0x2000)
-        bank &= 1;
-
-    // Compute CHR-ROM address
-    uint32_t final_addr = ((bank * bank_size) + (addr & (bank_size - 1)));
-
-    return cart->chr_rom.data[final_addr];
+    MapPrg(cart, 0x8000, 0, PRG_BANK_SIZE_32KIB);
+    MapChr(cart, 0x0000, cn_rom.chr_bank, 0x2000);
 }
 
-static uint8_t Mmc3ReadChrRom(Cart *cart, const uint16_t addr)
+static void AxRomUpdateBanks(Cart *cart)
 {
-    const uint32_t effective_addr = addr ^ (mmc3.bank_sel.chr_a12_invert * 0x1000);
-
-    // Branch version
-    //uint32_t final_addr = 0;
-    //if (effective_addr < 0x1000)
-    //{
-    //    // Reg 0 or 1
-    //    final_addr = ((mmc3.regs[effective_addr >> 11] * 0x800) + (effective_addr & 0x7FF));
-    //}
-    //else
-    //{
-    //    // Reg 2–5
-    //    final_addr = ((mmc3.regs[(effective_addr >> 10) - 2] * 0x400) + (effective_addr & 0x3FF));
-    //}
-
-    // Branchless
-    uint32_t region = effective_addr >> 12;
-    uint32_t shift = 10 + (region ^ 1);
-    uint32_t offset = region * 2;
-    uint32_t bank_size = 1 << shift;
-
-    uint32_t index = (effective_addr >> shift) - offset;
-    uint32_t bank_base = mmc3.regs[index] << shift;
-    uint32_t final_addr = bank_base | (effective_addr & (bank_size - 1));
-
-    return cart->chr_rom.data[final_addr];
+    MapPrg(cart, 0x8000, ax_rom.bank, PRG_BANK_SIZE_32KIB);
+    MapChr(cart, 0x0000, 0, 0x2000);
 }
 
-static uint8_t CnromReadChrRom(Cart *cart, const uint16_t addr)
+static void ColorDreamsUpdateBanks(Cart *cart)
 {
-    return cart->chr_rom.data[(cn_rom.chr_bank * 0x2000) + (addr & 0x1FFF)];
+    MapPrg(cart, 0x8000, color_dreams.prg_bank, PRG_BANK_SIZE_32KIB);
+    MapChr(cart, 0x0000, color_dreams.chr_bank, 0x2000);
 }
 
-static uint8_t ColorDreamsReadChrRom(Cart *cart, const uint16_t addr)
+static void NinjaUpdateBanks(Cart *cart)
 {
-    return cart->chr_rom.data[(color_dreams.chr_bank * 0x2000) + (addr & 0x1FFF)];
+    MapPrg(cart, 0x8000, ninja.prg_bank, PRG_BANK_SIZE_32KIB);
+    MapChr(cart, 0x0000, ninja.chr_bank0, 0x1000);
+    MapChr(cart, 0x1000, ninja.chr_bank1, 0x1000);
 }
 
-static uint8_t NinjaReadChrRom(Cart *cart, const uint16_t addr)
+static void BnRomUpdateBanks(Cart *cart)
 {
-    const int bank = addr < 0x1000 ? ninja.chr_bank0 : ninja.chr_bank1;
-    //printf("BANK: %d ADDR: 0x%X\n", bank, addr);
-    return cart->chr_rom.data[(bank * 0x1000) + (addr & 0xFFF)];
+    MapPrg(cart, 0x8000, bn_rom.bank, PRG_BANK_SIZE_32KIB);
+    MapChr(cart, 0x0000, 0, 0x2000);
 }
 
 static const int mmc1_mirror_map[4] =
@@ -294,7 +159,7 @@ static const int mmc1_mirror_map[4] =
     NAMETABLE_HORIZONTAL
 };
 
-static void Mmc1RegWrite(const uint16_t addr, const uint8_t data)
+static void Mmc1RegWrite(Cart *cart, const uint16_t addr, const uint8_t data)
 {
     if ((data >> 7) & 1)
     {
@@ -306,6 +171,7 @@ static void Mmc1RegWrite(const uint16_t addr, const uint8_t data)
         // Set last bank at $C000 and switch 16 KB bank at $8000
         mmc1.control.prg_rom_bank_mode = 0x3;
         mmc1.consec_write = true;
+        Mmc1UpdateBanks(cart);
         return;
     }
 
@@ -345,9 +211,10 @@ static void Mmc1RegWrite(const uint16_t addr, const uint8_t data)
     }
     mmc1.shift.raw = 0x10;
     mmc1.shift_count = 0;
+    Mmc1UpdateBanks(cart);
 }
 
-static void Mmc3RegWriteOdd(const uint16_t addr, const uint8_t data)
+static void Mmc3RegWriteOdd(Cart *cart, const uint16_t addr, const uint8_t data)
 {
     switch ((addr >> 13) & 0x3)
     {
@@ -364,6 +231,7 @@ static void Mmc3RegWriteOdd(const uint16_t addr, const uint8_t data)
                 effective_data = data >> 1;
             }
             mmc3.regs[mmc3.bank_sel.reg] = effective_data;
+            Mmc3UpdateBanks(cart);
         
             //printf("Set MMC3 reg %d bank value 0x%X\n", mmc3.bank_sel.reg, effective_data);
             break;
@@ -387,13 +255,14 @@ static void Mmc3RegWriteOdd(const uint16_t addr, const uint8_t data)
     }
 }
 
-static void Mmc3RegWriteEven(const uint16_t addr, const uint8_t data)
+static void Mmc3RegWriteEven(Cart *cart, const uint16_t addr, const uint8_t data)
 {
     switch ((addr >> 13) & 0x3)
     {
         // Bank select ($8000-$9FFE, even)
         case 0:
             mmc3.bank_sel.raw = data;
+            Mmc3UpdateBanks(cart);
             //printf("MMC3 Set bank selection: reg %d, prg_rom_bank_mode:%d, chr_a12_invert: %d\n",
             //        mmc3.bank_sel.reg, mmc3.bank_sel.prg_rom_bank_mode, mmc3.bank_sel.chr_a12_invert);
             break;
@@ -420,49 +289,53 @@ static void Mmc3RegWriteEven(const uint16_t addr, const uint8_t data)
     }
 }
 
-static void Mmc3RegWrite(const uint16_t addr, const uint8_t data)
+static void Mmc3RegWrite(Cart *cart, const uint16_t addr, const uint8_t data)
 {
     if (addr & 1)
     {
-        Mmc3RegWriteOdd(addr, data);
+        Mmc3RegWriteOdd(cart, addr, data);
     }
     else
     {
-        Mmc3RegWriteEven(addr, data);
+        Mmc3RegWriteEven(cart, addr, data);
     }
 }
 
-static void UxRomRegWrite(const uint16_t addr, const uint8_t data)
+static void UxRomRegWrite(Cart *cart, const uint16_t addr, const uint8_t data)
 {
     UNUSED(addr);
 
     ux_rom.bank = data;
+    UxRomUpdateBanks(cart);
     DEBUG_LOG("Set prg rom bank index to %d\n", data & 0x7);
 }
 
-static void AxRomRegWrite(const uint16_t addr, const uint8_t data)
+static void AxRomRegWrite(Cart *cart, const uint16_t addr, const uint8_t data)
 {
     UNUSED(addr);
 
     ax_rom.raw = data;
+    AxRomUpdateBanks(cart);
     PpuSetMirroring(2, ax_rom.page);
 }
 
-static void CnRomRegWrite(const uint16_t addr, const uint8_t data)
+static void CnRomRegWrite(Cart *cart, const uint16_t addr, const uint8_t data)
 {
     UNUSED(addr);
 
     cn_rom.raw = data;
+    CnRomUpdateBanks(cart);
 }
 
-static void ColorDreamsRegWrite(const uint16_t addr, const uint8_t data)
+static void ColorDreamsRegWrite(Cart *cart, const uint16_t addr, const uint8_t data)
 {
     UNUSED(addr);
 
     color_dreams.raw = data;
+    ColorDreamsUpdateBanks(cart);
 }
 
-static void NinjaRegWrite(const uint16_t addr, const uint8_t data)
+static void NinjaRegWrite(Cart *cart, const uint16_t addr, const uint8_t data)
 {
     switch (addr)
     {
@@ -481,32 +354,52 @@ static void NinjaRegWrite(const uint16_t addr, const uint8_t data)
             break;
         default:
             //printf("UNK addr: 0x%X\n", addr);
-            break;
+            return;
     }
+    NinjaUpdateBanks(cart);
 }
 
-static void BnRomRegWrite(const uint16_t addr, const uint8_t data)
+static void BnRomRegWrite(Cart *cart, const uint16_t addr, const uint8_t data)
 {
     UNUSED(addr);
     // TODO: Bus conflict like this?
     // data &= cart->prg_rom.data[addr];
     bn_rom.bank = data;
+    BnRomUpdateBanks(cart);
 }
 
-uint8_t MapperReadPrgRom(Cart *cart, const uint16_t addr)
-{
-    return cart->PrgReadFn(cart, addr);
-}
-
-uint8_t MapperReadChrRom(Cart *cart, const uint16_t addr)
-{
-    return cart->ChrReadFn(cart, addr);
-}
-
+// A switch over the mapper instead of a function pointer lets every handler be inlined here
 void MapperWrite(Cart *cart, const uint16_t addr, uint8_t data)
 {
-    if (cart->mapper_num != MAPPER_NROM)
-        cart->RegWriteFn(addr, data);
+    switch (cart->mapper_num)
+    {
+        case MAPPER_MMC1:
+            Mmc1RegWrite(cart, addr, data);
+            break;
+        case MAPPER_UXROM:
+            UxRomRegWrite(cart, addr, data);
+            break;
+        case MAPPER_CNROM:
+            CnRomRegWrite(cart, addr, data);
+            break;
+        case MAPPER_MMC3:
+            Mmc3RegWrite(cart, addr, data);
+            break;
+        case MAPPER_AXROM:
+            AxRomRegWrite(cart, addr, data);
+            break;
+        case MAPPER_COLORDREAMS:
+            ColorDreamsRegWrite(cart, addr, data);
+            break;
+        case MAPPER_BNROM_NINJA:
+            if (cart->mem_map == MEM_MAP_NINJA)
+                NinjaRegWrite(cart, addr, data);
+            else
+                BnRomRegWrite(cart, addr, data);
+            break;
+        default:
+            break;
+    }
 }
 
 void Mmc3ClockIrqCounter(Cart *cart)
@@ -540,72 +433,114 @@ bool PollMapperIrq(void)
 
 void MapperInit(Cart *cart)
 {
+    // Power on, nothing may carry over from the previous cart
+    memset(&mmc1, 0, sizeof(mmc1));
+    memset(&mmc3, 0, sizeof(mmc3));
+    memset(&ux_rom, 0, sizeof(ux_rom));
+    memset(&ax_rom, 0, sizeof(ax_rom));
+    memset(&cn_rom, 0, sizeof(cn_rom));
+    memset(&color_dreams, 0, sizeof(color_dreams));
+    memset(&ninja, 0, sizeof(ninja));
+    memset(&bn_rom, 0, sizeof(bn_rom));
+
     switch (cart->mapper_num)
     {
         case MAPPER_NROM:
-            cart->PrgReadFn = NromReadPrgRom;
-            cart->ChrReadFn = NromReadChrRom;
             cart->mem_map = MEM_MAP_NORMAL;
+            NromUpdateBanks(cart);
             break;
         case MAPPER_MMC1:
             mmc1.control.prg_rom_bank_mode = 3;
-            cart->PrgReadFn = Mmc1ReadPrgRom;
-            cart->ChrReadFn = Mmc1ReadChrRom;
-            cart->RegWriteFn = Mmc1RegWrite;
             cart->mem_map = MEM_MAP_NORMAL;
             cart->prg_rom.num_banks = GetNumPrgRomBanks(cart->prg_rom.size, PRG_BANK_SIZE_16KIB);
+            Mmc1UpdateBanks(cart);
             break;
         case MAPPER_UXROM:
-            cart->PrgReadFn = UxRomReadPrgRom;
-            cart->ChrReadFn = NromReadChrRom;
-            cart->RegWriteFn = UxRomRegWrite;
             cart->mem_map = MEM_MAP_NORMAL;
             cart->prg_rom.num_banks = GetNumPrgRomBanks(cart->prg_rom.size, PRG_BANK_SIZE_16KIB);
+            UxRomUpdateBanks(cart);
             break;
         case MAPPER_CNROM:
-            cart->PrgReadFn = NromReadPrgRom;
-            cart->ChrReadFn = CnromReadChrRom;
-            cart->RegWriteFn = CnRomRegWrite;
             cart->mem_map = MEM_MAP_NORMAL;
+            CnRomUpdateBanks(cart);
             break;
         case MAPPER_MMC3:
-            cart->PrgReadFn = Mmc3ReadPrgRom;
-            cart->ChrReadFn = Mmc3ReadChrRom;
-            cart->RegWriteFn = Mmc3RegWrite;
             cart->mem_map = MEM_MAP_NORMAL;
             cart->prg_rom.num_banks = GetNumPrgRomBanks(cart->prg_rom.size, PRG_BANK_SIZE_8KIB);
+            Mmc3UpdateBanks(cart);
             break;
         case MAPPER_AXROM:
-            cart->PrgReadFn = AxRomReadPrgRom;
-            cart->ChrReadFn = NromReadChrRom;
-            cart->RegWriteFn = AxRomRegWrite;
             cart->mem_map = MEM_MAP_NORMAL;
             cart->prg_rom.num_banks = GetNumPrgRomBanks(cart->prg_rom.size, PRG_BANK_SIZE_32KIB);
+            AxRomUpdateBanks(cart);
             break;
         case MAPPER_COLORDREAMS:
-            cart->PrgReadFn = ColorDreamsReadPrgRom;
-            cart->ChrReadFn = ColorDreamsReadChrRom;
-            cart->RegWriteFn = ColorDreamsRegWrite;
             cart->mem_map = MEM_MAP_NORMAL;
             cart->prg_rom.num_banks = GetNumPrgRomBanks(cart->prg_rom.size, PRG_BANK_SIZE_32KIB);
+            ColorDreamsUpdateBanks(cart);
             break;
         case MAPPER_BNROM_NINJA:
             cart->prg_rom.num_banks = GetNumPrgRomBanks(cart->prg_rom.size, PRG_BANK_SIZE_32KIB);
             if (cart->chr_rom.size > 0x2000)
             {
-                cart->PrgReadFn = NinjaReadPrgRom;
-                cart->ChrReadFn = NinjaReadChrRom;
-                cart->RegWriteFn = NinjaRegWrite;
                 cart->mem_map = MEM_MAP_NINJA;
+                NinjaUpdateBanks(cart);
                 break;
             }
-            cart->PrgReadFn = BnRomReadPrgRom;
-            cart->ChrReadFn = NromReadChrRom;
-            cart->RegWriteFn = BnRomRegWrite;
             cart->mem_map = MEM_MAP_NORMAL;
+            BnRomUpdateBanks(cart);
             break;
         default:
             printf("Bad Mapper type!: %d\n", cart->mapper_num);
             break;
     }
 }
+
+// Bank registers of every mapper, the slots are repointed from them after a load
+void MapperStateSync(Cart *cart, State *state)
+{
+    STATE_FIELD(state, mmc1);
+    STATE_FIELD(state, mmc3);
+    STATE_FIELD(state, ux_rom);
+    STATE_FIELD(state, ax_rom);
+    STATE_FIELD(state, cn_rom);
+    STATE_FIELD(state, color_dreams);
+    STATE_FIELD(state, ninja);
+    STATE_FIELD(state, bn_rom);
+
+    if (!state->loading)
+        return;
+
+    switch (cart->mapper_num)
+    {
+        case MAPPER_NROM:
+            NromUpdateBanks(cart);
+            break;
+        case MAPPER_MMC1:
+            Mmc1UpdateBanks(cart);
+            break;
+        case MAPPER_UXROM:
+            UxRomUpdateBanks(cart);
+            break;
+        case MAPPER_CNROM:
+            CnRomUpdateBanks(cart);
+            break;
+        case MAPPER_MMC3:
+            Mmc3UpdateBanks(cart);
+            break;
+        case MAPPER_AXROM:
+            AxRomUpdateBanks(cart);
+            break;
+        case MAPPER_COLORDREAMS:
+            ColorDreamsUpdateBanks(cart);
+            break;
+        case MAPPER_BNROM_NINJA:
+            if (cart->mem_map == MEM_MAP_NINJA)
+                NinjaUpdateBanks(cart);
+            else
+                BnRomUpdateBanks(cart);
+            break;
+        default:
+            break;
+    }
+}
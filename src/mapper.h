@@ -26,13 +26,12 @@ typedef enum
     MEM_MAP_NINJA
 } MemMapType;
 
-uint8_t MapperReadPrgRom(Cart *cart, const uint16_t addr);
-uint8_t MapperReadChrRom(Cart *cart, const uint16_t addr);
 void MapperWrite(Cart *cart, const uint16_t addr, uint8_t data);
 
 void Mmc3ClockIrqCounter(Cart *cart);
 bool PollMapperIrq(void);
 void MapperInit(Cart *cart);
+void MapperStateSync(Cart *cart, State *state);
 
 extern Mmc1 mmc1;
 extern Mmc3 mmc3;
@@ -43,4 +42,17 @@ extern ColorDreams color_dreams;
 extern Ninja ninja;
 extern BnRom bn_rom;
 
+// Reads are on every bus access, keep them in the header so they inline into the bus and the PPU
+static inline uint8_t MapperReadPrgRom(Cart *cart, const uint16_t addr)
+{
+    // Any read in between lets MMC1 accept the next write, a store is cheaper than checking the mapper
+    mmc1.consec_write = false;
+    return cart->prg_slots[(addr >> 13) & 0x3][addr & (PRG_SLOT_SIZE - 1)];
+}
+
+static inline uint8_t MapperReadChrRom(Cart *cart, const uint16_t addr)
+{
+    return cart->chr_slots[(addr >> 10) & 0x7][addr & (CHR_SLOT_SIZE - 1)];
+}
+
 #endif
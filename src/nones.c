@@ -12,44 +12,37 @@
 #include "cart.h"
 #include "nones.h"
 
-#define HIGH_RATE_SAMPLES 14890
-#define LOW_RATE_SAMPLES 735
-//#define LOW_RATE_SAMPLES 800
-
 static SDL_AudioStream *stream = NULL;
+// When set the audio device paces emulation instead of the frame timer
+static bool audio_sync = false;
 
-static void SampleTo44khz(const float *high_rate_buffer, int16_t *output_44khz_buffer)
+static int NonesAudioQueued(void)
 {
-    const double step = (double)(HIGH_RATE_SAMPLES) / LOW_RATE_SAMPLES;
-
-    double pos = 0.0;
-    for (int i = 0; i < LOW_RATE_SAMPLES; i++)
-    {
-        int index = (int)pos;
-        double frac = pos - index;
-
-        // Simple linear interpolation
-        float a = high_rate_buffer[index];
-        float b = (index + 1 < (HIGH_RATE_SAMPLES)) ? high_rate_buffer[index + 1] : a;
-
-        float sample = (float)((1.0 - frac) * a + frac * b);
-        // convert to s16
-        output_44khz_buffer[i] = (int16_t)(sample * 32767);
-
-        pos += step;
-    }
+    return SDL_GetAudioStreamQueued(stream) / sizeof(int16_t);
 }
 
 void NonesPutSoundData(Apu *apu)
 {
-    // Buffer size of 4096 samples
-    const int minimum_audio = (4096 * sizeof(int16_t));
-    if (SDL_GetAudioStreamQueued(stream) < minimum_audio)
-    {
-        SampleTo44khz(apu->buffer, apu->outbuffer);
+    // Without a stream (library builds) the samples stay in outbuffer for the caller
+    if (!stream)
+        return;
+
+    const int queued = NonesAudioQueued();
+    const int target = apu->sample_rate * AUDIO_LATENCY_MS / 1000;
 
-        SDL_PutAudioStreamData(stream, apu->outbuffer, sizeof(apu->outbuffer));
+    // Rate control keeps the queue near the target, only drop audio if something stalled
+    // badly enough that it can't catch up
+    if (queued < target * 4)
+    {
+        SDL_PutAudioStreamData(stream, apu->outbuffer, apu->out_count * sizeof(int16_t));
     }
+    apu->out_count = 0;
+
+    // The device is the clock when audio paced, nothing to correct for
+    if (audio_sync)
+        APU_ResetRateControl(apu);
+    else
+        APU_UpdateRateControl(apu, queued, target);
 }
 
 static void NonesDrawDebugInfo(Nones *nones, NonesInfo *info)
@@ -86,6 +79,100 @@ static void NonesSetIntegerScale(Nones *nones, int scale)
     SDL_SetWindowPosition(nones->window,  SDL_WINDOWPOS_CENTERED,  SDL_WINDOWPOS_CENTERED);
 }
 
+static void NonesToggleNtsc(Nones *nones)
+{
+    if (!nones->ntsc)
+    {
+        const uint32_t index_size = SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint16_t);
+        if (!nones->index_buffers[0])
+        {
+            nones->index_buffers[0] = ArenaPush(nones->arena, index_size);
+            nones->index_buffers[1] = ArenaPush(nones->arena, index_size);
+        }
+
+        // Let SDL pick the worker count from the available cores
+        nones->ntsc = nones->index_buffers[0] && nones->index_buffers[1] ? NtscCreate(NTSC_MIN_SCALE, 0) : NULL;
+        if (!nones->ntsc)
+        {
+            SDL_Log("NTSC filter unavailable, out of memory or threads");
+            return;
+        }
+
+        nones->ntsc_texture = SDL_CreateTexture(nones->renderer,
+            SDL_PIXELFORMAT_RGBA8888,
+            SDL_TEXTUREACCESS_STREAMING,
+            nones->ntsc->out_width, SCREEN_HEIGHT);
+        if (!nones->ntsc_texture)
+        {
+            SDL_Log("NTSC texture Error: %s", SDL_GetError());
+            NtscDestroy(nones->ntsc);
+            nones->ntsc = NULL;
+            return;
+        }
+
+        SDL_SetTextureScaleMode(nones->ntsc_texture, SDL_SCALEMODE_LINEAR);
+    }
+
+    nones->ntsc_enabled = !nones->ntsc_enabled;
+    PPU_SetIndexBuffers(nones->system->ppu, nones->ntsc_enabled ? nones->index_buffers : NULL);
+}
+
+static void NonesToggleAudioSync(void)
+{
+    audio_sync = !audio_sync;
+    SDL_Log("Audio sync: %s", audio_sync ? "on" : "off");
+}
+
+static void NonesRunFrame(Nones *nones, NonesInfo *info)
+{
+    SystemRun(nones->system, nones->state, nones->debug_info);
+
+    // Filtering and scaling happen on worker threads, this only hands the frame over
+    if (nones->ntsc_enabled && nones->state != PAUSED)
+        NtscSubmitFrame(nones->ntsc, nones->index_buffers[1], nones->system->ppu->frames);
+    if (nones->scaler && nones->state != PAUSED)
+        ScalerSubmitFrame(nones->scaler, nones->system->ppu->buffers[1]);
+
+    if (nones->state > PAUSED)
+        nones->state = PAUSED;
+
+    ++info->updates;
+}
+
+static void NonesCycleScaler(Nones *nones)
+{
+    ScalerDestroy(nones->scaler);
+    nones->scaler = NULL;
+    if (nones->scaler_texture)
+    {
+        SDL_DestroyTexture(nones->scaler_texture);
+        nones->scaler_texture = NULL;
+    }
+
+    nones->scaler_mode = (nones->scaler_mode + 1) % SCALER_MODE_COUNT;
+    if (nones->scaler_mode == SCALER_NONE)
+        return;
+
+    nones->scaler = ScalerCreate(nones->scaler_mode, 2);
+    if (nones->scaler)
+    {
+        nones->scaler_texture = SDL_CreateTexture(nones->renderer,
+            SDL_PIXELFORMAT_RGBA8888,
+            SDL_TEXTUREACCESS_STREAMING,
+            nones->scaler->out_width, nones->scaler->out_height);
+    }
+    if (!nones->scaler_texture)
+    {
+        SDL_Log("Scaler unavailable, out of memory or threads");
+        ScalerDestroy(nones->scaler);
+        nones->scaler = NULL;
+        nones->scaler_mode = SCALER_NONE;
+        return;
+    }
+
+    SDL_SetTextureScaleMode(nones->scaler_texture, SDL_SCALEMODE_LINEAR);
+}
+
 static void NonesHandleInput(Nones *nones)
 {
     const bool *kb_state  = SDL_GetKeyboardState(NULL);
@@ -143,10 +230,10 @@ static void NonesHandleInput(Nones *nones)
 static void NonesInit(Nones *nones, const char *path)
 {
     memset(nones, 0, sizeof(*nones));
-    nones->arena = ArenaCreate(1024 * 1024 * 3);
-    nones->system = SystemCreate(nones->arena);
+    nones->arena = ArenaCreate(SystemArenaSize(), ARENA_DEFAULT);
+    nones->system = nones->arena ? SystemCreate(nones->arena) : NULL;
 
-    if (SystemLoadCart(nones->arena, nones->system, path))
+    if (!nones->system || SystemLoadCart(nones->arena, nones->system, path, NULL))
     {
         ArenaDestroy(nones->arena);
         exit(EXIT_FAILURE);
@@ -204,7 +291,7 @@ static void NonesInit(Nones *nones, const char *path)
     SDL_AudioSpec spec;
     spec.channels = 1;
     spec.format = SDL_AUDIO_S16;
-    spec.freq = 44100;
+    spec.freq = APU_SAMPLE_RATE;
 
     stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, NULL, NULL);
     if (!stream)
@@ -232,6 +319,8 @@ static void NonesInit(Nones *nones, const char *path)
 static void NonesShutdown(Nones *nones)
 {
     SystemShutdown(nones->system);
+    NtscDestroy(nones->ntsc);
+    ScalerDestroy(nones->scaler);
 
     // Handles textures as well, so no need to call SDL_DestroyTexture here
     SDL_DestroyRenderer(nones->renderer);
@@ -262,8 +351,15 @@ void NonesRun(Nones *nones, const char *path)
     const uint32_t buffer_size = (SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(uint32_t));
     buffers[0] = ArenaPush(nones->arena, buffer_size);
     buffers[1] = ArenaPush(nones->arena, buffer_size);
+    if (!buffers[0] || !buffers[1])
+    {
+        SDL_Log("Out of memory for the frame buffers");
+        NonesShutdown(nones);
+        exit(EXIT_FAILURE);
+    }
 
     SystemInit(nones->system, buffers);
+    APU_SetAudioChunk(nones->system->apu, AUDIO_CHUNK_SAMPLES);
     SDL_Event event;
     void *raw_pixels;
     int raw_pitch;
@@ -305,6 +401,15 @@ void NonesRun(Nones *nones, const char *path)
                         case SDLK_F2:
                             NonesReset(nones);
                             break;
+                        case SDLK_F3:
+                            NonesToggleNtsc(nones);
+                            break;
+                        case SDLK_F4:
+                            NonesCycleScaler(nones);
+                            break;
+                        case SDLK_F5:
+                            NonesToggleAudioSync();
+                            break;
                         case SDLK_F6:
                             nones->state ^= PAUSED;
                             break;
@@ -321,23 +426,52 @@ void NonesRun(Nones *nones, const char *path)
 
         NonesHandleInput(nones);
 
+        if (audio_sync)
+        {
+            // Run frames whenever the device has played the queue down below the target,
+            // the frame cap delay below is the polling interval
+            const int target = nones->system->apu->sample_rate * AUDIO_LATENCY_MS / 1000;
+            for (int frames = 0; frames < 4 && nones->state != PAUSED && NonesAudioQueued() < target; frames++)
+            {
+                NonesRunFrame(nones, &info);
+            }
+            accumulator = 0;
+        }
+
         while (accumulator >= FRAME_TIME_NS)
         {
-            SystemRun(nones->system, nones->state, nones->debug_info);
+            NonesRunFrame(nones, &info);
+            accumulator -= FRAME_TIME_NS;
+        }
 
-            if (nones->state > PAUSED)
-                nones->state = PAUSED;
+        SDL_Texture *frame_texture = NULL;
+        if (nones->ntsc_enabled)
+        {
+            SDL_LockTexture(nones->ntsc_texture, NULL, &raw_pixels, &raw_pitch);
+            if (NtscReadFrame(nones->ntsc, raw_pixels, raw_pitch))
+                frame_texture = nones->ntsc_texture;
+            SDL_UnlockTexture(nones->ntsc_texture);
+        }
 
-            accumulator -= FRAME_TIME_NS;
-            ++info.updates;
+        if (!frame_texture && nones->scaler)
+        {
+            SDL_LockTexture(nones->scaler_texture, NULL, &raw_pixels, &raw_pitch);
+            if (ScalerReadFrame(nones->scaler, raw_pixels, raw_pitch))
+                frame_texture = nones->scaler_texture;
+            SDL_UnlockTexture(nones->scaler_texture);
         }
 
-        SDL_LockTexture(nones->texture, NULL, &raw_pixels, &raw_pitch);
-        memcpy(raw_pixels, nones->system->ppu->buffers[1], buffer_size);
-        SDL_UnlockTexture(nones->texture);
+        // Show the raw frame until the worker threads have produced their first one
+        if (!frame_texture)
+        {
+            SDL_LockTexture(nones->texture, NULL, &raw_pixels, &raw_pitch);
+            memcpy(raw_pixels, nones->system->ppu->buffers[1], buffer_size);
+            SDL_UnlockTexture(nones->texture);
+            frame_texture = nones->texture;
+        }
 
         SDL_RenderClear(nones->renderer);
-        SDL_RenderTexture(nones->renderer, nones->texture, NULL, NULL);
+        SDL_RenderTexture(nones->renderer, frame_texture, NULL, NULL);
 
         NonesDrawDebugInfo(nones, &info);
 
@@ -5,19 +5,25 @@
 #include <stdbool.h>
 #include "arena.h"
 #include "system.h"
+#include "ntsc.h"
+#include "scaler.h"
 #include <SDL3/SDL.h>
 
 //#define SCREEN_WIDTH 340
 //#define SCREEN_HEIGHT 260
 #define SCREEN_WIDTH 256
 #define SCREEN_HEIGHT 240
-#define FRAMERATE 60
+// NTSC: 1789772.73 Hz CPU clock / 29780.5 CPU cycles per frame
+#define FRAMERATE 60.0988138
 #define FRAMECAP 500
-//#define FRAMERATE 60.098477556112265
 #define FRAME_TIME_MS (1000.0 / FRAMERATE)
 #define FRAME_CAP_MS (1000.0 / FRAMECAP)
 #define FRAME_TIME_NS (1000000000.0 / FRAMERATE)
 #define FRAME_CAP_NS (1000000000.0 / FRAMECAP)
+// Audio queued for the device that rate control aims for
+#define AUDIO_LATENCY_MS 40
+// Output samples the APU delivers at a time, well under a frame
+#define AUDIO_CHUNK_SAMPLES 256
 
 typedef struct
 {
@@ -36,12 +42,19 @@ typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *texture;
+    SDL_Texture *ntsc_texture;
+    NtscFilter *ntsc;
+    uint16_t *index_buffers[2];
+    SDL_Texture *scaler_texture;
+    Scaler *scaler;
+    ScalerMode scaler_mode;
     SDL_Gamepad *gamepad1;
     SDL_Gamepad *gamepad2;
     SDL_JoystickID *gamepads;
     int num_gamepads;
     SystemState state;
     bool debug_info;
+    bool ntsc_enabled;
     bool quit;
 } Nones;
 
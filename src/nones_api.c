@@ -1,4 +1,5 @@
 #include "cart.h"
+#include "forkserver.h"
 #include "system.h"
 #include "nones.h"
 #include <stdio.h>
@@ -12,9 +13,21 @@
 
 // Global emulator instance
 static Nones g_nones;
+// Flags for the emulator arena, see nones_set_huge_pages
+static ArenaFlags g_arena_flags = ARENA_DEFAULT;
 
 // Custom SRAM save path (if set)
-static char g_custom_save_path[256] = {0};
+static char g_custom_save_path[CART_SAVE_PATH_SIZE] = {0};
+
+// NTSC filter, g_ntsc_mutex guards the filter and the enabled flag
+static NtscFilter *g_ntsc = NULL;
+static SDL_Mutex *g_ntsc_mutex = NULL;
+static bool g_ntsc_enabled = false;
+static uint16_t *g_index_buffers[2] = {NULL, NULL};
+
+// Post-processing scaler, g_scaler_mutex guards the scaler
+static Scaler *g_scaler = NULL;
+static SDL_Mutex *g_scaler_mutex = NULL;
 
 // Debug helper
 // Properly shutdown the emulator and flush SRAM to .sav
@@ -22,28 +35,71 @@ void nones_shutdown() {
     if (g_nones.system) {
         SystemShutdown(g_nones.system);
     }
-}
-
-// Set custom save file path for SRAM
-void nones_set_save_path(const char* save_path) {
-    if (save_path && strlen(save_path) < sizeof(g_custom_save_path)) {
-        strncpy(g_custom_save_path, save_path, sizeof(g_custom_save_path) - 1);
-        g_custom_save_path[sizeof(g_custom_save_path) - 1] = '\0';
+    if (g_ntsc_mutex) {
+        SDL_LockMutex(g_ntsc_mutex);
+        NtscDestroy(g_ntsc);
+        g_ntsc = NULL;
+        g_ntsc_enabled = false;
+        if (g_nones.system) {
+            PPU_SetIndexBuffers(g_nones.system->ppu, NULL);
+        }
+        free(g_index_buffers[0]);
+        free(g_index_buffers[1]);
+        g_index_buffers[0] = NULL;
+        g_index_buffers[1] = NULL;
+        SDL_UnlockMutex(g_ntsc_mutex);
+    }
+    if (g_scaler_mutex) {
+        SDL_LockMutex(g_scaler_mutex);
+        ScalerDestroy(g_scaler);
+        g_scaler = NULL;
+        SDL_UnlockMutex(g_scaler_mutex);
     }
 }
 
 // Threading and synchronization
 static atomic_bool g_realtime_running = false;
 static SDL_Thread *g_realtime_thread = NULL;
-static SDL_Mutex *g_audio_mutex = NULL;
 static SDL_Mutex *g_video_mutex = NULL;
 static atomic_bool g_paused = false; // soft pause flag
 
-// Audio ring buffer for smooth playback - increased size for better buffering
-#define AUDIO_RING_SIZE (44100 * 4)  // 4 seconds of audio buffer for better stability
-static int16_t g_audio_ring[AUDIO_RING_SIZE];
-static atomic_int g_audio_write_pos = 0;
-static atomic_int g_audio_read_pos = 0;
+// Requested output format, applied by the emulation thread before the next frame
+static atomic_int g_sample_rate = APU_SAMPLE_RATE;
+static atomic_int g_audio_quality = BLIP_QUALITY_MEDIUM;
+static atomic_bool g_audio_enabled = true;
+// Per channel mute bits, gains (APU_GAIN_UNITY = 1.0) and stem output, applied like the format
+static atomic_int g_channel_mutes = 0;
+static atomic_int g_channel_gains[APU_CHANNEL_COUNT] = {
+    APU_GAIN_UNITY, APU_GAIN_UNITY, APU_GAIN_UNITY, APU_GAIN_UNITY, APU_GAIN_UNITY
+};
+static atomic_bool g_audio_stems = false;
+// Output samples per chunk the APU hands to the ring, 0 for whole frames
+static atomic_int g_audio_chunk = AUDIO_CHUNK_SAMPLES;
+
+// Lock-free audio ring, the emulation thread is the only producer and the host's audio
+// callback the only consumer. Positions run freely and are masked on access, so
+// write - read is always the fill level. Capacity is a power of two.
+#define AUDIO_RING_DEFAULT_MS 250
+#define AUDIO_RING_MIN_MS 20
+#define AUDIO_RING_MAX_MS 2000
+static int16_t *g_audio_ring = NULL;
+static uint32_t g_audio_ring_mask = 0;
+static int g_audio_ring_ms = AUDIO_RING_DEFAULT_MS;
+// Most samples that may be queued, g_audio_ring_ms at the active rate
+static atomic_uint g_audio_ring_limit = 0;
+static atomic_uint g_audio_write_pos = 0;
+static atomic_uint g_audio_read_pos = 0;
+// Anyone may request a flush by moving this to the current write position, readers and the
+// producer's space check start from here while it is ahead of the read position
+static atomic_uint g_audio_flush_pos = 0;
+static atomic_uint g_audio_overruns = 0;
+static atomic_uint g_audio_underruns = 0;
+// Dynamic rate control target and the last ratio/drift it reported, in parts per million
+static atomic_int g_audio_target_ms = AUDIO_LATENCY_MS;
+static atomic_int g_audio_ratio_ppm = 0;
+static atomic_int g_audio_drift_ppm = 0;
+// Pace emulation by the host pulling audio instead of a frame timer
+static atomic_bool g_audio_sync = false;
 
 // Video frame management
 static atomic_bool g_new_frame_available = false;
@@ -54,39 +110,107 @@ static uint32_t g_last_frame_retrieved = 0;
 static uint64_t g_last_fps_time = 0;
 static uint32_t g_fps_counter = 0;
 static float g_current_fps = 0.0f;
-static uint32_t g_audio_underruns = 0;
 // Timing accumulator reset flag to indicate a fresh start (prevents burst after pause)
 static atomic_bool g_reset_timing = false;
 
 // Controller input state
 static uint8_t g_controller_state[2] = {0, 0};
 
+// Recompute the fill limit for the active sample rate
+static void update_audio_ring_limit(int sample_rate) {
+    uint32_t limit = (uint32_t)((uint64_t)sample_rate * g_audio_ring_ms / 1000);
+    atomic_store(&g_audio_ring_limit, limit < g_audio_ring_mask + 1 ? limit : g_audio_ring_mask + 1);
+}
+
+// Size the ring for ms of audio at the highest rate. Only safe while nothing produces or consumes.
+static int resize_audio_ring(int ms) {
+    uint32_t capacity = 1;
+    while (capacity < (uint32_t)((uint64_t)APU_MAX_SAMPLE_RATE * ms / 1000)) {
+        capacity <<= 1;
+    }
+
+    int16_t* ring = calloc(capacity, sizeof(int16_t));
+    if (!ring) return -1;
+
+    free(g_audio_ring);
+    g_audio_ring = ring;
+    g_audio_ring_mask = capacity - 1;
+    g_audio_ring_ms = ms;
+    atomic_store(&g_audio_write_pos, 0);
+    atomic_store(&g_audio_read_pos, 0);
+    atomic_store(&g_audio_flush_pos, 0);
+    update_audio_ring_limit(atomic_load(&g_sample_rate));
+    return 0;
+}
+
+// Where the next read starts, past anything queued before the last flush
+static uint32_t get_audio_read_start(uint32_t read_pos, uint32_t flush_pos) {
+    return (int32_t)(flush_pos - read_pos) > 0 ? flush_pos : read_pos;
+}
+
 // Helper function to get available audio samples in ring buffer
 static size_t get_audio_samples_available() {
-    int write_pos = atomic_load(&g_audio_write_pos);
-    int read_pos = atomic_load(&g_audio_read_pos);
-    if (write_pos >= read_pos) {
-        return write_pos - read_pos;
-    } else {
-        return AUDIO_RING_SIZE - read_pos + write_pos;
-    }
+    uint32_t write_pos = atomic_load_explicit(&g_audio_write_pos, memory_order_acquire);
+    uint32_t read_pos = atomic_load_explicit(&g_audio_read_pos, memory_order_acquire);
+    uint32_t flush_pos = atomic_load_explicit(&g_audio_flush_pos, memory_order_acquire);
+    return write_pos - get_audio_read_start(read_pos, flush_pos);
 }
 
-// Helper function to write audio samples to ring buffer
+// Producer side: append samples, dropping what doesn't fit instead of overwriting unread audio
 static void write_audio_samples(const int16_t* samples, size_t count) {
-    if (!g_audio_mutex) return;
+    if (!g_audio_ring) return;
+
+    uint32_t write_pos = atomic_load_explicit(&g_audio_write_pos, memory_order_relaxed);
+    uint32_t read_pos = atomic_load_explicit(&g_audio_read_pos, memory_order_acquire);
+    uint32_t flush_pos = atomic_load_explicit(&g_audio_flush_pos, memory_order_acquire);
+    uint32_t limit = atomic_load_explicit(&g_audio_ring_limit, memory_order_relaxed);
+    // Flushed samples are dead, their space can be reused before the consumer skips them
+    uint32_t used = write_pos - get_audio_read_start(read_pos, flush_pos);
+    size_t space = used < limit ? limit - used : 0;
+
+    if (count > space) {
+        atomic_fetch_add(&g_audio_overruns, 1);
+        count = space;
+    }
 
-    SDL_LockMutex(g_audio_mutex);
+    // At most two segments, up to the end of the ring and then from the start
+    size_t start = write_pos & g_audio_ring_mask;
+    size_t first = (count < g_audio_ring_mask + 1 - start) ? count : g_audio_ring_mask + 1 - start;
+    memcpy(&g_audio_ring[start], samples, first * sizeof(int16_t));
+    memcpy(g_audio_ring, &samples[first], (count - first) * sizeof(int16_t));
 
-    int write_pos = atomic_load(&g_audio_write_pos);
-    for (size_t i = 0; i < count; i++) {
-        g_audio_ring[write_pos] = samples[i];
-        write_pos = (write_pos + 1) % AUDIO_RING_SIZE;
-    }
+    atomic_store_explicit(&g_audio_write_pos, write_pos + (uint32_t)count, memory_order_release);
+}
 
-    atomic_store(&g_audio_write_pos, write_pos);
+// The APU calls this with every chunk while real-time emulation runs
+static void ring_audio_callback(void *userdata, const int16_t *samples, int count) {
+    (void)userdata;
+    write_audio_samples(samples, (size_t)count);
+}
 
-    SDL_UnlockMutex(g_audio_mutex);
+// Run one frame, its audio goes to the ring chunk by chunk as it is produced. Rate control
+// is off when the audio clock paces emulation, the ring level is what drives it then.
+static void run_realtime_frame(bool rate_control) {
+    if (g_nones.system && g_nones.system->apu) {
+        APU_SetAudioCallback(g_nones.system->apu, ring_audio_callback, NULL);
+    }
+    nones_advance_frame();
+    if (g_nones.system && g_nones.system->apu) {
+        Apu *apu = g_nones.system->apu;
+
+        if (rate_control) {
+            // Steer the resampling ratio so the ring stays at the target latency
+            int target = apu->sample_rate * atomic_load(&g_audio_target_ms) / 1000;
+            APU_UpdateRateControl(apu, (int)get_audio_samples_available(), target);
+        } else {
+            APU_ResetRateControl(apu);
+        }
+        atomic_store(&g_audio_ratio_ppm, (int)((apu->rate_ratio - 1.0) * 1e6));
+        atomic_store(&g_audio_drift_ppm, (int)(apu->rate_drift * 1e6));
+    }
+    atomic_store(&g_new_frame_available, true);
+    g_frame_counter++;
+    g_fps_counter++;
 }
 
 // Thread function for real-time emulation loop
@@ -97,8 +221,8 @@ static int realtime_emulation_thread(void *data) {
     // Set high thread priority for better timing (SDL3 function name)
     SDL_SetCurrentThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
 
-    // NES nominal frame time (~16.67ms)
-    const uint64_t frame_time_ns = 1000000000ULL / 60;
+    // NES nominal frame time (~16.64ms at 60.0988 Hz)
+    const uint64_t frame_time_ns = (uint64_t)FRAME_TIME_NS;
 
     // Properly initialize timing so first delta isn't huge (which caused resume speed burst)
     uint64_t previous_time = SDL_GetTicksNS();
@@ -114,36 +238,46 @@ static int realtime_emulation_thread(void *data) {
             delta_time = frame_time_ns; // treat as exactly one frame spacing
             accumulator = 0.0;
         }
-        accumulator += (double)delta_time;
-
-        // Run whole frames while accumulator has enough time; never loop runaway on first frame anymore
-        while (accumulator >= frame_time_ns) {
-            if (!atomic_load(&g_paused)) {
-                nones_advance_frame();
-                if (g_nones.system && g_nones.system->apu) {
-                    write_audio_samples(g_nones.system->apu->outbuffer, 735);
+
+        // Without audio there is nothing for the host to drain, fall back to the frame timer
+        bool audio_sync = atomic_load(&g_audio_sync) && atomic_load(&g_audio_enabled);
+        if (audio_sync) {
+            // The host's audio callback is the clock: emulate whenever it has drained the ring
+            // below the target. Capped so a host that stopped pulling can't spin us. The level
+            // counts from the last flush, so after a start, state load or rate change only the
+            // audio missing since then is made up instead of racing until the host next reads.
+            accumulator = 0.0;
+            size_t target = (size_t)atomic_load(&g_sample_rate) * atomic_load(&g_audio_target_ms) / 1000;
+            for (int frames = 0; frames < 4 && !atomic_load(&g_paused) && get_audio_samples_available() < target; frames++) {
+                run_realtime_frame(false);
+            }
+        } else {
+            accumulator += (double)delta_time;
+
+            // Run whole frames while accumulator has enough time; never loop runaway on first frame anymore
+            while (accumulator >= frame_time_ns) {
+                if (!atomic_load(&g_paused)) {
+                    run_realtime_frame(true);
+                } else {
+                    // While paused we still want to keep accumulator bounded so it doesn't explode
+                    // but we purposely do NOT advance emulation or push audio.
                 }
-                atomic_store(&g_new_frame_available, true);
-                g_frame_counter++;
-            } else {
-                // While paused we still want to keep accumulator bounded so it doesn't explode
-                // but we purposely do NOT advance emulation or push audio.
+                accumulator -= frame_time_ns;
             }
-            accumulator -= frame_time_ns;
         }
 
         // FPS accounting once per second
-        g_fps_counter++;
         if (current_time - g_last_fps_time >= 1000000000ULL) {
             g_current_fps = (float)g_fps_counter;
             g_fps_counter = 0;
             g_last_fps_time = current_time;
         }
 
-        // Sleep remaining slice to hold 60 FPS
+        // Poll the ring often when audio paced, otherwise sleep the remaining slice of the frame
+        uint64_t slice_ns = audio_sync ? 1000000ULL : frame_time_ns;
         uint64_t frame_elapsed = SDL_GetTicksNS() - current_time;
-        if (frame_elapsed < frame_time_ns) {
-            SDL_DelayNS(frame_time_ns - frame_elapsed);
+        if (frame_elapsed < slice_ns) {
+            SDL_DelayNS(slice_ns - frame_elapsed);
         }
     }
 
@@ -156,8 +290,7 @@ void nones_run_realtime() {
     if (g_realtime_thread) return; // Already running
 
     // Initialize mutexes if not already done
-    if (!g_audio_mutex) {
-        g_audio_mutex = SDL_CreateMutex();
+    if (!g_video_mutex) {
         g_video_mutex = SDL_CreateMutex();
     }
 
@@ -165,12 +298,12 @@ void nones_run_realtime() {
     g_last_fps_time = SDL_GetTicksNS();
     g_fps_counter = 0;
     g_current_fps = 0.0f;
-    g_audio_underruns = 0;
+    atomic_store(&g_audio_overruns, 0);
+    atomic_store(&g_audio_underruns, 0);
     atomic_store(&g_reset_timing, true);
 
     // Clear audio buffer for clean start
-    atomic_store(&g_audio_write_pos, 0);
-    atomic_store(&g_audio_read_pos, 0);
+    nones_flush_audio_buffer();
 
     atomic_store(&g_realtime_running, true);
     g_realtime_thread = SDL_CreateThread(realtime_emulation_thread, "nones_realtime", NULL);
@@ -184,11 +317,12 @@ void nones_stop_realtime() {
     SDL_WaitThread(g_realtime_thread, NULL);
     g_realtime_thread = NULL;
 
-    // Cleanup mutexes
-    if (g_audio_mutex) {
-        SDL_DestroyMutex(g_audio_mutex);
-        g_audio_mutex = NULL;
+    // Stepped frames keep their audio in outbuffer
+    if (g_nones.system && g_nones.system->apu) {
+        APU_SetAudioCallback(g_nones.system->apu, NULL, NULL);
     }
+
+    // Cleanup mutexes
     if (g_video_mutex) {
         SDL_DestroyMutex(g_video_mutex);
         g_video_mutex = NULL;
@@ -248,11 +382,47 @@ void nones_advance_frame() {
         SystemUpdateJPButtons(g_nones.system, buttons);
     }
 
+    // Switch the synthesis rate here so it never changes in the middle of a frame
+    Apu *apu = g_nones.system->apu;
+    if (apu->sample_rate != atomic_load(&g_sample_rate) || (int)apu->blip.quality != atomic_load(&g_audio_quality)) {
+        APU_SetSampleRate(apu, atomic_load(&g_sample_rate), (BlipQuality)atomic_load(&g_audio_quality));
+        update_audio_ring_limit(apu->sample_rate);
+        nones_flush_audio_buffer();
+    }
+    if (apu->audio_enabled != atomic_load(&g_audio_enabled)) {
+        APU_SetAudioEnabled(apu, atomic_load(&g_audio_enabled));
+    }
+    if (apu->stems_enabled != atomic_load(&g_audio_stems)) {
+        APU_SetStemsEnabled(apu, atomic_load(&g_audio_stems));
+    }
+    int mutes = atomic_load(&g_channel_mutes);
+    for (int channel = 0; channel < APU_CHANNEL_COUNT; channel++) {
+        bool muted = (mutes >> channel) & 1;
+        if (((apu->channel_mutes >> channel) & 1) != muted) {
+            APU_SetChannelMute(apu, (ApuChannel)channel, muted);
+        }
+        if (apu->channel_gains[channel] != atomic_load(&g_channel_gains[channel])) {
+            APU_SetChannelGain(apu, (ApuChannel)channel, atomic_load(&g_channel_gains[channel]));
+        }
+    }
+    if (apu->chunk_samples != atomic_load(&g_audio_chunk)) {
+        APU_SetAudioChunk(apu, atomic_load(&g_audio_chunk));
+    }
+    // outbuffer (and the stems) only hold this frame's samples afterwards
+    apu->out_count = 0;
+
     // Reset PPU frame_finished flag to ensure we run a full frame
     if (g_nones.system->ppu) {
         g_nones.system->ppu->frame_finished = false;
     }
 
+    // Only record color indices while the NTSC filter wants them
+    if (g_ntsc_mutex) {
+        SDL_LockMutex(g_ntsc_mutex);
+        PPU_SetIndexBuffers(g_nones.system->ppu, g_ntsc_enabled ? g_index_buffers : NULL);
+        SDL_UnlockMutex(g_ntsc_mutex);
+    }
+
     // Track cycles at start of frame
     uint64_t start_cycles = g_nones.system->cpu->cycles;
 
@@ -274,6 +444,24 @@ void nones_advance_frame() {
         // Add missing cycles and update APU accordingly
         SystemAddCpuCycles(missing_cycles);
     }
+
+    // Hand the frame to the NTSC worker threads, filtering happens off this thread
+    if (g_ntsc_mutex) {
+        SDL_LockMutex(g_ntsc_mutex);
+        if (g_ntsc_enabled && g_ntsc) {
+            NtscSubmitFrame(g_ntsc, g_index_buffers[1], g_nones.system->ppu->frames);
+        }
+        SDL_UnlockMutex(g_ntsc_mutex);
+    }
+
+    // The scaler works on this frame while the next one is emulated
+    if (g_scaler_mutex) {
+        SDL_LockMutex(g_scaler_mutex);
+        if (g_scaler) {
+            ScalerSubmitFrame(g_scaler, g_nones.system->ppu->buffers[1]);
+        }
+        SDL_UnlockMutex(g_scaler_mutex);
+    }
 }
 
 // Return pointer to current video frame (RGBA8888), set width/height
@@ -300,10 +488,167 @@ const uint8_t* nones_get_video_frame(uint32_t* width, uint32_t* height) {
     return result;
 }
 
+// Enable or disable the NTSC composite filter, scale is the horizontal scale (2 or 3)
+void nones_set_ntsc_filter(int enabled, int scale) {
+    if (!g_ntsc_mutex) return;
+
+    scale = scale < NTSC_MIN_SCALE ? NTSC_MIN_SCALE : scale > NTSC_MAX_SCALE ? NTSC_MAX_SCALE : scale;
+
+    SDL_LockMutex(g_ntsc_mutex);
+
+    if (enabled) {
+        if (g_ntsc && g_ntsc->scale != scale) {
+            NtscDestroy(g_ntsc);
+            g_ntsc = NULL;
+        }
+        if (!g_ntsc) {
+            g_ntsc = NtscCreate(scale, 0);
+        }
+        if (!g_index_buffers[0]) g_index_buffers[0] = calloc(SCREEN_WIDTH * SCREEN_HEIGHT, sizeof(uint16_t));
+        if (!g_index_buffers[1]) g_index_buffers[1] = calloc(SCREEN_WIDTH * SCREEN_HEIGHT, sizeof(uint16_t));
+    }
+    // Stays off if the filter or either index buffer couldn't be allocated
+    g_ntsc_enabled = enabled && g_ntsc && g_index_buffers[0] && g_index_buffers[1];
+
+    SDL_UnlockMutex(g_ntsc_mutex);
+}
+
+// Copy the last NTSC filtered frame (RGBA8888) into dst, set width/height
+int nones_get_ntsc_frame(uint32_t* dst, uint32_t* width, uint32_t* height) {
+    if (!g_ntsc_mutex) return 1;
+
+    SDL_LockMutex(g_ntsc_mutex);
+
+    if (!g_ntsc) {
+        SDL_UnlockMutex(g_ntsc_mutex);
+        return 1;
+    }
+
+    if (width) *width = (uint32_t)g_ntsc->out_width;
+    if (height) *height = SCREEN_HEIGHT;
+
+    int result = 0;
+    if (dst && !NtscReadFrame(g_ntsc, dst, g_ntsc->out_width * (int)sizeof(uint32_t))) {
+        result = 2;
+    }
+
+    SDL_UnlockMutex(g_ntsc_mutex);
+
+    return result;
+}
+
+// Select the audio output rate and resampling quality
+int nones_set_audio_format(int sample_rate, int quality) {
+    if (sample_rate != 44100 && sample_rate != 48000 && sample_rate != 96000) return -1;
+    if (quality < 0 || quality >= BLIP_QUALITY_COUNT) return -1;
+
+    atomic_store(&g_sample_rate, sample_rate);
+    atomic_store(&g_audio_quality, quality);
+    return 0;
+}
+
+// Turn audio synthesis off for headless runs, CPU visible APU state is still emulated
+void nones_set_audio_enabled(int enabled) {
+    atomic_store(&g_audio_enabled, enabled != 0);
+}
+
+// Mute or unmute one APU channel
+void nones_set_channel_mute(int channel, int muted) {
+    if (channel < 0 || channel >= APU_CHANNEL_COUNT) return;
+    if (muted) {
+        atomic_fetch_or(&g_channel_mutes, 1 << channel);
+    } else {
+        atomic_fetch_and(&g_channel_mutes, ~(1 << channel));
+    }
+}
+
+// Set the gain of one APU channel, 1.0 is unity
+void nones_set_channel_gain(int channel, float gain) {
+    if (channel < 0 || channel >= APU_CHANNEL_COUNT) return;
+    if (gain < 0.0f) gain = 0.0f;
+    if (gain > (float)APU_GAIN_MAX / APU_GAIN_UNITY) gain = (float)APU_GAIN_MAX / APU_GAIN_UNITY;
+    atomic_store(&g_channel_gains[channel], (int)(gain * APU_GAIN_UNITY + 0.5f));
+}
+
+// Enable per channel stem output
+void nones_set_audio_stems(int enabled) {
+    atomic_store(&g_audio_stems, enabled != 0);
+}
+
+// Copy the last frame's per channel samples into channels[0..4], return the samples per channel
+size_t nones_get_audio_stems(int16_t** channels, size_t max_samples) {
+    if (!channels || !g_nones.system || !g_nones.system->apu) return 0;
+
+    Apu *apu = g_nones.system->apu;
+    if (!apu->stems_enabled) return 0;
+
+    size_t count = (max_samples < (size_t)apu->out_count) ? max_samples : (size_t)apu->out_count;
+    for (int channel = 0; channel < APU_CHANNEL_COUNT; channel++) {
+        if (channels[channel]) {
+            memcpy(channels[channel], apu->stem_buffers[channel], count * sizeof(int16_t));
+        }
+    }
+    return count;
+}
+
+// Set how many output samples the APU delivers to the ring at a time, 0 for one chunk per frame.
+// Clamped the same way APU_SetAudioChunk does so the stored value matches the applied one.
+void nones_set_audio_chunk(int samples) {
+    if (samples < 0) samples = 0;
+    if (samples > 0 && samples < APU_MIN_CHUNK_SAMPLES) samples = APU_MIN_CHUNK_SAMPLES;
+    if (samples > APU_OUT_BUFFER_SIZE / 2) samples = APU_OUT_BUFFER_SIZE / 2;
+    atomic_store(&g_audio_chunk, samples);
+}
+
+// Get the audio output rate in Hz
+int nones_get_audio_sample_rate() {
+    return atomic_load(&g_sample_rate);
+}
+
+// Select the post-processing scaler, factor is only used by nearest scaling
+void nones_set_scaler(int mode, int factor) {
+    if (!g_scaler_mutex) return;
+
+    SDL_LockMutex(g_scaler_mutex);
+
+    ScalerDestroy(g_scaler);
+    g_scaler = NULL;
+    if (mode > SCALER_NONE && mode < SCALER_MODE_COUNT) {
+        g_scaler = ScalerCreate((ScalerMode)mode, factor);
+    }
+
+    SDL_UnlockMutex(g_scaler_mutex);
+}
+
+// Copy the last scaled frame (RGBA8888) into dst, set width/height
+int nones_get_scaled_frame(uint32_t* dst, uint32_t* width, uint32_t* height) {
+    if (!g_scaler_mutex) return 1;
+
+    SDL_LockMutex(g_scaler_mutex);
+
+    if (!g_scaler) {
+        SDL_UnlockMutex(g_scaler_mutex);
+        return 1;
+    }
+
+    if (width) *width = (uint32_t)g_scaler->out_width;
+    if (height) *height = (uint32_t)g_scaler->out_height;
+
+    int result = 0;
+    if (dst && !ScalerReadFrame(g_scaler, dst, g_scaler->out_width * (int)sizeof(uint32_t))) {
+        result = 2;
+    }
+
+    SDL_UnlockMutex(g_scaler_mutex);
+
+    return result;
+}
+
 // Get the current audio buffer fill level (0.0 to 1.0)
 float nones_get_audio_buffer_level() {
     size_t available = get_audio_samples_available();
-    return (float)available / (float)AUDIO_RING_SIZE;
+    uint32_t limit = atomic_load(&g_audio_ring_limit);
+    return limit ? (float)available / (float)limit : 0.0f;
 }
 
 // Check if new video frame is available since last call
@@ -321,22 +666,48 @@ void nones_set_controller_input(int controller, uint8_t buttons) {
 // Get emulation timing statistics
 void nones_get_timing_stats(float* fps, float* audio_underruns) {
     if (fps) *fps = g_current_fps;
-    if (audio_underruns) *audio_underruns = (float)g_audio_underruns;
+    if (audio_underruns) *audio_underruns = (float)atomic_load(&g_audio_underruns);
 }
 
 // Flush/clear the audio ring buffer (useful for seeking or reset)
 void nones_flush_audio_buffer() {
-    if (g_audio_mutex) {
-        SDL_LockMutex(g_audio_mutex);
-    }
+    // Only the consumer may move the read position, it skips up to here on its next read.
+    // Samples written after this point are kept.
+    atomic_store(&g_audio_flush_pos, atomic_load(&g_audio_write_pos));
+}
 
-    atomic_store(&g_audio_write_pos, 0);
-    atomic_store(&g_audio_read_pos, 0);
-    memset(g_audio_ring, 0, sizeof(g_audio_ring));
+// Set the audio ring size in milliseconds, only while real-time emulation is stopped
+int nones_set_audio_buffer_ms(int ms) {
+    if (g_realtime_thread) return -1;
+    if (ms < AUDIO_RING_MIN_MS) ms = AUDIO_RING_MIN_MS;
+    if (ms > AUDIO_RING_MAX_MS) ms = AUDIO_RING_MAX_MS;
+    return resize_audio_ring(ms);
+}
 
-    if (g_audio_mutex) {
-        SDL_UnlockMutex(g_audio_mutex);
-    }
+// Set the audio latency that dynamic rate control aims for
+void nones_set_audio_target_latency(int ms) {
+    if (ms < AUDIO_RING_MIN_MS / 2) ms = AUDIO_RING_MIN_MS / 2;
+    if (ms > g_audio_ring_ms / 2) ms = g_audio_ring_ms / 2;
+    atomic_store(&g_audio_target_ms, ms);
+}
+
+// Pace emulation from the audio callback instead of a frame timer
+void nones_set_audio_sync(int enabled) {
+    atomic_store(&g_audio_sync, enabled != 0);
+    atomic_store(&g_reset_timing, true);
+}
+
+// Get the queued audio, the current resampling ratio and the measured clock drift
+void nones_get_audio_sync_stats(float* fill_ms, float* ratio, float* drift_ppm) {
+    if (fill_ms) *fill_ms = (float)get_audio_samples_available() * 1000.0f / (float)atomic_load(&g_sample_rate);
+    if (ratio) *ratio = 1.0f + (float)atomic_load(&g_audio_ratio_ppm) / 1e6f;
+    if (drift_ppm) *drift_ppm = (float)atomic_load(&g_audio_drift_ppm);
+}
+
+// Get how many times the ring was full on write and empty on read
+void nones_get_audio_xruns(uint32_t* overruns, uint32_t* underruns) {
+    if (overruns) *overruns = atomic_load(&g_audio_overruns);
+    if (underruns) *underruns = atomic_load(&g_audio_underruns);
 }
 
 // Get audio latency information
@@ -344,7 +715,7 @@ void nones_get_audio_latency_info(float* buffer_ms, int* samples_available) {
     size_t available = get_audio_samples_available();
 
     if (buffer_ms) {
-        *buffer_ms = (float)available / 44100.0f * 1000.0f; // Convert to milliseconds
+        *buffer_ms = (float)available / (float)atomic_load(&g_sample_rate) * 1000.0f; // Convert to milliseconds
     }
     if (samples_available) {
         *samples_available = (int)available;
@@ -355,39 +726,40 @@ void nones_get_audio_latency_info(float* buffer_ms, int* samples_available) {
 size_t nones_get_audio_samples(int16_t* buffer, size_t max_samples) {
     if (!buffer || max_samples == 0) return 0;
 
-    if (!g_audio_mutex) return 0;
+    if (!g_audio_ring) return 0;
 
-    SDL_LockMutex(g_audio_mutex);
+    uint32_t flush_pos = atomic_load_explicit(&g_audio_flush_pos, memory_order_acquire);
+    uint32_t write_pos = atomic_load_explicit(&g_audio_write_pos, memory_order_acquire);
+    uint32_t read_pos = get_audio_read_start(atomic_load_explicit(&g_audio_read_pos, memory_order_relaxed), flush_pos);
 
-    size_t available = get_audio_samples_available();
+    size_t available = write_pos - read_pos;
     size_t to_copy = (max_samples < available) ? max_samples : available;
 
-    if (to_copy == 0) {
-        // Audio underrun - fill with silence
-        memset(buffer, 0, max_samples * sizeof(int16_t));
-        g_audio_underruns++;
-        SDL_UnlockMutex(g_audio_mutex);
-        return max_samples; // Return max_samples to indicate buffer was filled with silence
-    }
-
-    int read_pos = atomic_load(&g_audio_read_pos);
+    // Copy samples from ring buffer in at most two segments
+    size_t start = read_pos & g_audio_ring_mask;
+    size_t first = (to_copy < g_audio_ring_mask + 1 - start) ? to_copy : g_audio_ring_mask + 1 - start;
+    memcpy(buffer, &g_audio_ring[start], first * sizeof(int16_t));
+    memcpy(&buffer[first], g_audio_ring, (to_copy - first) * sizeof(int16_t));
 
-    // Copy samples from ring buffer
-    for (size_t i = 0; i < to_copy; i++) {
-        buffer[i] = g_audio_ring[read_pos];
-        read_pos = (read_pos + 1) % AUDIO_RING_SIZE;
-    }
-
-    // Fill remaining buffer with silence if needed
+    // Audio underrun - fill the rest with silence
     if (to_copy < max_samples) {
         memset(&buffer[to_copy], 0, (max_samples - to_copy) * sizeof(int16_t));
+        atomic_fetch_add(&g_audio_underruns, 1);
     }
 
-    atomic_store(&g_audio_read_pos, read_pos);
+    atomic_store_explicit(&g_audio_read_pos, read_pos + (uint32_t)to_copy, memory_order_release);
+    // Drag a consumed flush point along so it never drifts far enough behind to look ahead
+    // again after the counters wrap. Fails harmlessly if a new flush came in meanwhile.
+    atomic_compare_exchange_strong(&g_audio_flush_pos, &flush_pos, read_pos + (uint32_t)to_copy);
 
-    SDL_UnlockMutex(g_audio_mutex);
+    return max_samples; // Always fills the whole buffer, padding with silence
+}
 
-    return max_samples;
+// Back emulator memory with huge pages, only before nones_init
+int nones_set_huge_pages(int enabled) {
+    if (g_nones.arena) return -1;
+    g_arena_flags = enabled ? ARENA_HUGE_PAGES : ARENA_DEFAULT;
+    return 0;
 }
 
 // Initialize the emulator (without loading a ROM)
@@ -400,7 +772,19 @@ int nones_init() {
         return 3;
     }
 
-    g_nones.arena = ArenaCreate(1024 * 1024 * 3);
+    if (!g_ntsc_mutex) {
+        g_ntsc_mutex = SDL_CreateMutex();
+    }
+    if (!g_scaler_mutex) {
+        g_scaler_mutex = SDL_CreateMutex();
+    }
+
+    // Initialize audio ring buffer
+    if (resize_audio_ring(g_audio_ring_ms) != 0) return 1;
+
+    // Sized for the system alone, each ROM load grows it by exactly what the cart needs. With
+    // huge pages the block is rounded up to one huge page, which has room for the cart too.
+    g_nones.arena = ArenaCreate(SystemArenaSize(), g_arena_flags);
     if (!g_nones.arena) return 1;
 
     g_nones.system = SystemCreate(g_nones.arena);
@@ -409,11 +793,6 @@ int nones_init() {
         return 2;
     }
 
-    // Initialize audio ring buffer
-    memset(g_audio_ring, 0, sizeof(g_audio_ring));
-    atomic_store(&g_audio_write_pos, 0);
-    atomic_store(&g_audio_read_pos, 0);
-
     // Initialize frame tracking
     atomic_store(&g_new_frame_available, false);
     g_frame_counter = 0;
@@ -424,7 +803,8 @@ int nones_init() {
 
     // Initialize performance counters
     g_current_fps = 0.0f;
-    g_audio_underruns = 0;
+    atomic_store(&g_audio_overruns, 0);
+    atomic_store(&g_audio_underruns, 0);
 
     return 0;
 }
@@ -433,7 +813,8 @@ int nones_init() {
 int nones_load_rom(const char* path) {
     if (!g_nones.arena || !g_nones.system) return 1;
     // Load the ROM using SystemLoadCart
-    int result = SystemLoadCart(g_nones.arena, g_nones.system, path);
+    int result = SystemLoadCart(g_nones.arena, g_nones.system, path,
+                                g_custom_save_path[0] ? g_custom_save_path : NULL);
     if (result == 0) {
         // Set up PPU/APU/CPU and video buffers
         static uint32_t* buffers[2] = {NULL, NULL};
@@ -445,31 +826,76 @@ int nones_load_rom(const char* path) {
     return result;
 }
 
-// Helper: get SRAM save path
-static void get_sram_save_path(char* out_path, size_t out_size) {
-    if (g_custom_save_path[0]) {
-        strncpy(out_path, g_custom_save_path, out_size - 1);
-        out_path[out_size - 1] = '\0';
-    } else if (g_nones.system && g_nones.system->cart && g_nones.system->cart->name) {
-        snprintf(out_path, out_size, "%s.sav", g_nones.system->cart->name);
-    } else {
-        out_path[0] = '\0';
+// Set custom save file path for SRAM, moves the loaded cart's battery RAM there unless
+// the realtime thread is running, in which case it applies from the next nones_load_rom
+void nones_set_save_path(const char* save_path) {
+    if (save_path && strlen(save_path) < sizeof(g_custom_save_path)) {
+        strncpy(g_custom_save_path, save_path, sizeof(g_custom_save_path) - 1);
+        g_custom_save_path[sizeof(g_custom_save_path) - 1] = '\0';
+        if (g_nones.system && g_nones.system->cart && g_nones.system->cart->image
+            && !atomic_load(&g_realtime_running)) {
+            CartSetSavePath(g_nones.system->cart, g_custom_save_path);
+        }
     }
 }
 
 // Save SRAM to file
 int nones_save_sram() {
     if (!g_nones.system || !g_nones.system->cart || !g_nones.system->cart->battery) return 1;
-    char save_path[256];
-    get_sram_save_path(save_path, sizeof(save_path));
-    if (!save_path[0]) return 2;
-    FILE *sav = fopen(save_path, "wb");
-    if (!sav) return 3;
-    fwrite(g_nones.system->cart->ram, CART_RAM_SIZE, 1, sav);
-    fclose(sav);
+    if (!g_nones.system->cart->save_path[0]) return 2;
+    if (CartSaveSram(g_nones.system->cart)) return 3;
     return 0;
 }
 
+// Arena bytes in use, mapped, and the most ever in use
+void nones_get_arena_stats(size_t* used, size_t* reserved, size_t* high_water) {
+    const Arena *arena = g_nones.arena;
+    if (used) *used = arena ? arena->used : 0;
+    if (reserved) *reserved = arena ? arena->reserved : 0;
+    if (high_water) *high_water = arena ? arena->high_water : 0;
+}
+
+// Run or restore the cached post-boot state
+int nones_boot(const char* cache_dir, int frames, const uint8_t* buttons) {
+    if (!g_nones.system || !g_nones.system->cart->image || !cache_dir || frames < 0) return -1;
+    if (g_realtime_thread) return -1;
+    SystemBootScript script = { frames, (const uint8_t (*)[2])buttons };
+    int result = SystemBoot(g_nones.system, &script, cache_dir);
+    nones_flush_audio_buffer();
+    return result;
+}
+
+// Save the full machine state to path
+int nones_save_state(const char* path) {
+    if (!g_nones.system || !g_nones.system->cart->image || !path) return -1;
+    return SystemSaveStateFile(g_nones.system, path);
+}
+
+// Restore a state saved by nones_save_state for the loaded ROM
+int nones_load_state(const char* path) {
+    if (!g_nones.system || !g_nones.system->cart->image || !path) return -1;
+    if (g_realtime_thread) return -1;
+    int result = SystemLoadStateFile(g_nones.system, path);
+    nones_flush_audio_buffer();
+    return result;
+}
+
+// Serve process isolated sessions from the loaded (and booted) machine, see ForkServerRun
+int nones_fork_server(const char* socket_path) {
+    if (!g_nones.system || !g_nones.system->cart->image || !socket_path) return -1;
+    // Their threads wouldn't exist in the children
+    if (g_realtime_thread || g_ntsc || g_scaler) return -1;
+
+    int conn = ForkServerRun(socket_path);
+    if (conn < 0) return -1;
+
+    // Sessions share the parent's save file mapping otherwise
+    CartForgetSavePath(g_nones.system->cart);
+    g_custom_save_path[0] = '\0';
+    nones_flush_audio_buffer();
+    return conn;
+}
+
 // Performs a soft reset of the emulator (resets CPU, PPU, etc. without reloading ROM).
 void nones_soft_reset(void) {
     if (g_nones.system) {
@@ -59,15 +59,106 @@ NONES_API void nones_flush_audio_buffer();
 // Properly shutdown the emulator and flush SRAM to .sav
 NONES_API void nones_shutdown();
 
-// Set custom save file path for SRAM
+// Set custom save file path for SRAM, battery RAM is kept in this file from then on
 NONES_API void nones_set_save_path(const char* save_path);
 
 // Save SRAM to file (uses custom path if set)
 NONES_API int nones_save_sram();
 
+// Run the boot sequence of a freshly loaded ROM: frames frames holding buttons (2 bytes per frame,
+// controller 1 and 2 in the nones_set_controller_input layout, NULL for none). The resulting state
+// is cached in cache_dir by ROM and core version, later sessions resume from it instantly.
+// Call right after nones_load_rom, before anything runs or loads a state. Returns 1 if restored
+// from cache, 0 if run, -1 on error or if the machine already ran.
+NONES_API int nones_boot(const char* cache_dir, int frames, const uint8_t* buttons);
+
+// Back emulator memory with huge pages (2 MiB) where the system allows it, falls back to normal
+// pages otherwise. Call before nones_init. Returns 0 on success, -1 if already initialized.
+NONES_API int nones_set_huge_pages(int enabled);
+
+// Emulator memory: bytes in use, bytes mapped and the high-water mark of bytes in use
+NONES_API void nones_get_arena_stats(size_t* used, size_t* reserved, size_t* high_water);
+
+// Save/restore the full machine state, 0 on success
+NONES_API int nones_save_state(const char* path);
+NONES_API int nones_load_state(const char* path);
+
+// Linux only. Fork a process isolated session for every connection to the Unix socket at
+// socket_path, each starting from the machine as it is now (load the ROM and nones_boot first,
+// don't start real-time emulation, the NTSC filter or the scaler). Only returns in the parent
+// if serving fails (-1). In a child it returns the connected socket, whose client first reads
+// the child's pid (4 bytes); battery RAM isn't saved there until nones_set_save_path is called.
+NONES_API int nones_fork_server(const char* socket_path);
+
 // Get audio latency information
 NONES_API void nones_get_audio_latency_info(float* buffer_ms, int* samples_available);
 
+// Set how much audio may be queued, in milliseconds (20-2000, default 250). Only allowed while
+// real-time emulation is stopped. Returns 0 on success.
+NONES_API int nones_set_audio_buffer_ms(int ms);
+
+// Get how often the audio queue was full when emulation wrote to it (overruns)
+// and empty when nones_get_audio_samples read from it (underruns)
+NONES_API void nones_get_audio_xruns(uint32_t* overruns, uint32_t* underruns);
+
+// Set the audio latency (ms, default 40) that dynamic rate control keeps the queue at by nudging
+// the resampling ratio up to +-0.5%. Capped at half the buffer size set with nones_set_audio_buffer_ms.
+NONES_API void nones_set_audio_target_latency(int ms);
+
+// Audio-driven pacing: instead of a 60.0988 Hz timer, real-time emulation runs frames whenever
+// nones_get_audio_samples has drained the queue below the target latency, so the host's audio
+// callback becomes the clock. Video frames are published as they complete. Off by default.
+NONES_API void nones_set_audio_sync(int enabled);
+
+// Get the queued audio in milliseconds, the current resampling ratio (1.0 = nominal) and the
+// long term drift between the emulated and host clocks in parts per million.
+NONES_API void nones_get_audio_sync_stats(float* fill_ms, float* ratio, float* drift_ppm);
+
+// Enable or disable the NTSC composite video filter. scale is the horizontal output scale (2 or 3).
+// Filtering runs on worker threads, so it does not slow down emulation.
+NONES_API void nones_set_ntsc_filter(int enabled, int scale);
+
+// Copy the last NTSC filtered frame (RGBA8888) into dst, which must hold width * height pixels.
+// Pass NULL for dst to only query the size. Returns 0 on success, nonzero if no filtered frame is available.
+NONES_API int nones_get_ntsc_frame(uint32_t* dst, uint32_t* width, uint32_t* height);
+
+// Set the audio output rate (44100, 48000 or 96000 Hz) and resampling quality (0 = low, 1 = medium, 2 = high).
+// Takes effect before the next emulated frame and flushes queued audio. Returns 0 on success, -1 if unsupported.
+NONES_API int nones_set_audio_format(int sample_rate, int quality);
+
+// Enable or disable audio synthesis (enabled by default). With audio disabled the APU only emulates what
+// the CPU can observe (length counters, $4015, IRQs, DMC DMA timing) and no samples are produced, which
+// speeds up headless runs. Takes effect before the next emulated frame.
+NONES_API void nones_set_audio_enabled(int enabled);
+
+// APU channels for the mute, gain and stem functions: 0 = pulse 1, 1 = pulse 2, 2 = triangle, 3 = noise, 4 = DMC.
+// Muted channels are left out of the nonlinear mix. Gain (0.0-2.0, default 1.0) scales a channel's share of the mix.
+NONES_API void nones_set_channel_mute(int channel, int muted);
+NONES_API void nones_set_channel_gain(int channel, float gain);
+
+// Enable per channel stem output. Stems are each channel's share of the mix before gain, at the output rate,
+// and add up to the unmuted mix. Takes effect before the next emulated frame.
+NONES_API void nones_set_audio_stems(int enabled);
+
+// Copy the stems of the last frame run with nones_advance_frame into channels[0..4] (NULL entries are skipped),
+// up to max_samples each. Returns the number of samples per channel. Meant for stepped, not real-time, use.
+NONES_API size_t nones_get_audio_stems(int16_t** channels, size_t max_samples);
+
+// Set how many output samples (16-2048, default 256) the emulator hands to the audio queue at a time during
+// real-time emulation, or 0 for once per frame. Smaller chunks let the host run with a smaller audio buffer.
+NONES_API void nones_set_audio_chunk(int samples);
+
+// Get the audio output rate in Hz
+NONES_API int nones_get_audio_sample_rate();
+
+// Select the post-processing scaler: 0 = off, 1 = integer nearest, 2 = scale2x, 3 = scale3x, 4 = xBR-lite (2x).
+// factor (1-4) is only used by nearest scaling. Scaling runs on its own thread one frame behind emulation.
+NONES_API void nones_set_scaler(int mode, int factor);
+
+// Copy the last scaled frame (RGBA8888) into dst, which must hold width * height pixels.
+// Pass NULL for dst to only query the size. Returns 0 on success, nonzero if no scaled frame is available.
+NONES_API int nones_get_scaled_frame(uint32_t* dst, uint32_t* width, uint32_t* height);
+
 // Performs a soft reset of the emulator (resets CPU, PPU, etc. without reloading ROM).
 NONES_API void nones_soft_reset(void);
 
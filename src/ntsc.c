@@ -0,0 +1,364 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+#include <math.h>
+
+#include <SDL3/SDL.h>
+
+#include "ntsc.h"
+#include "nones.h"
+#include "utils.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NTSC_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define NTSC_LINE_SAMPLES (SCREEN_WIDTH * NTSC_SAMPLES_PER_PIXEL)
+// Black padding on both sides of a line so every decode window is full
+#define NTSC_LINE_PAD (NTSC_DECODE_WINDOW / 2)
+
+// Decoder phase offset in samples that lines the hues up with the PPU palette
+#define NTSC_HUE_SHIFT 4
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Composite samples for every 9 bit pixel value, one set per starting subcarrier phase.
+// A pixel is 8 samples long and a line starts on a multiple of 4, so only phases 0, 4 and 8 happen.
+static alignas(16) float encode_lut[512][3][NTSC_SAMPLES_PER_PIXEL];
+// Y, I and Q demodulation weights for a window starting at each of the 12 phases
+static alignas(16) float decode_lut[12][3][NTSC_DECODE_WINDOW];
+static bool tables_ready;
+
+static bool NtscInColorPhase(const int color, const int phase)
+{
+    return (color + phase) % 12 < 6;
+}
+
+// Signal level of a pixel at a given subcarrier phase, normalized so black is 0 and white is 1
+static float NtscSignal(const int pixel, const int phase)
+{
+    static const float levels[8] =
+    {
+        // Signal low
+        0.228f, 0.312f, 0.552f, 0.880f,
+        // Signal high
+        0.616f, 0.840f, 1.100f, 1.100f
+    };
+    const float black = 0.312f;
+    const float white = 1.100f;
+    const float attenuation = 0.746f;
+
+    const int color = pixel & 0x0F;
+    const int emphasis = pixel >> 6;
+    // Colors $xE and $xF always use level 1
+    const int level = color > 13 ? 1 : (pixel >> 4) & 3;
+
+    float low = levels[level];
+    float high = levels[4 + level];
+
+    // Color 0 only emits the high level, colors $xD-$xF only the low level
+    if (!color)
+        low = high;
+    if (color > 12)
+        high = low;
+
+    float signal = NtscInColorPhase(color, phase) ? high : low;
+
+    // Emphasis bits attenuate the signal during their part of the color cycle
+    if (((emphasis & 1) && NtscInColorPhase(0, phase)) ||
+        ((emphasis & 2) && NtscInColorPhase(4, phase)) ||
+        ((emphasis & 4) && NtscInColorPhase(8, phase)))
+    {
+        signal *= attenuation;
+    }
+
+    return (signal - black) / (white - black);
+}
+
+static void NtscBuildTables(void)
+{
+    if (tables_ready)
+        return;
+
+    for (int pixel = 0; pixel < 512; pixel++)
+    {
+        for (int phase = 0; phase < 3; phase++)
+        {
+            for (int i = 0; i < NTSC_SAMPLES_PER_PIXEL; i++)
+                encode_lut[pixel][phase][i] = NtscSignal(pixel, phase * 4 + i);
+        }
+    }
+
+    for (int phase = 0; phase < 12; phase++)
+    {
+        for (int i = 0; i < NTSC_DECODE_WINDOW; i++)
+        {
+            decode_lut[phase][0][i] = 1.0f / NTSC_DECODE_WINDOW;
+            decode_lut[phase][1][i] = (float)cos(M_PI * (phase + i + NTSC_HUE_SHIFT) / 6) / NTSC_DECODE_WINDOW;
+            decode_lut[phase][2][i] = (float)sin(M_PI * (phase + i + NTSC_HUE_SHIFT) / 6) / NTSC_DECODE_WINDOW;
+        }
+    }
+
+    tables_ready = true;
+}
+
+static inline uint32_t NtscYiqToRgba(const float y, const float i, const float q)
+{
+    const float r = y + 0.946882f * i + 0.623557f * q;
+    const float g = y - 0.274788f * i - 0.635691f * q;
+    const float b = y - 1.108545f * i + 1.709007f * q;
+
+    const uint32_t r8 = (uint32_t)(MIN(MAX(r, 0.0f), 1.0f) * 255.0f);
+    const uint32_t g8 = (uint32_t)(MIN(MAX(g, 0.0f), 1.0f) * 255.0f);
+    const uint32_t b8 = (uint32_t)(MIN(MAX(b, 0.0f), 1.0f) * 255.0f);
+
+    return (r8 << 24) | (g8 << 16) | (b8 << 8) | 255;
+}
+
+// Demodulate 12 samples starting at window with the weights for phase
+static inline uint32_t NtscDecodePixel(const float *window, const int phase)
+{
+    const float *y_weights = decode_lut[phase][0];
+    const float *i_weights = decode_lut[phase][1];
+    const float *q_weights = decode_lut[phase][2];
+
+#ifdef NTSC_USE_SSE2
+    const __m128 s0 = _mm_loadu_ps(window);
+    const __m128 s1 = _mm_loadu_ps(window + 4);
+    const __m128 s2 = _mm_loadu_ps(window + 8);
+
+    __m128 y = _mm_mul_ps(s0, _mm_load_ps(y_weights + 0));
+    y = _mm_add_ps(y, _mm_mul_ps(s1, _mm_load_ps(y_weights + 4)));
+    y = _mm_add_ps(y, _mm_mul_ps(s2, _mm_load_ps(y_weights + 8)));
+
+    __m128 i = _mm_mul_ps(s0, _mm_load_ps(i_weights + 0));
+    i = _mm_add_ps(i, _mm_mul_ps(s1, _mm_load_ps(i_weights + 4)));
+    i = _mm_add_ps(i, _mm_mul_ps(s2, _mm_load_ps(i_weights + 8)));
+
+    __m128 q = _mm_mul_ps(s0, _mm_load_ps(q_weights + 0));
+    q = _mm_add_ps(q, _mm_mul_ps(s1, _mm_load_ps(q_weights + 4)));
+    q = _mm_add_ps(q, _mm_mul_ps(s2, _mm_load_ps(q_weights + 8)));
+
+    // Horizontal sums of all three at once
+    __m128 zero = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(y, i, q, zero);
+    alignas(16) float yiq[4];
+    _mm_store_ps(yiq, _mm_add_ps(_mm_add_ps(y, i), _mm_add_ps(q, zero)));
+
+    return NtscYiqToRgba(yiq[0], yiq[1], yiq[2]);
+#else
+    float y = 0.0f;
+    float i = 0.0f;
+    float q = 0.0f;
+
+    for (int n = 0; n < NTSC_DECODE_WINDOW; n++)
+    {
+        y += window[n] * y_weights[n];
+        i += window[n] * i_weights[n];
+        q += window[n] * q_weights[n];
+    }
+
+    return NtscYiqToRgba(y, i, q);
+#endif
+}
+
+static void NtscFilterLines(NtscFilter *ntsc, const uint16_t *input, uint32_t *output, const int frame_phase,
+                            const int first_line, const int last_line)
+{
+    alignas(16) float signal[NTSC_LINE_PAD + NTSC_LINE_SAMPLES + NTSC_LINE_PAD] = {0};
+    float *line_signal = &signal[NTSC_LINE_PAD];
+
+    for (int y = first_line; y < last_line; y++)
+    {
+        // Each scanline is 341 dots of 8 samples, which moves the subcarrier by 4 samples
+        const int line_phase = (frame_phase + y * 4) % 12;
+        const uint16_t *pixels = &input[y * SCREEN_WIDTH];
+        uint32_t *out = &output[y * ntsc->out_width];
+
+        for (int x = 0; x < SCREEN_WIDTH; x++)
+        {
+            const int phase = ((line_phase + x * NTSC_SAMPLES_PER_PIXEL) % 12) / 4;
+            memcpy(&line_signal[x * NTSC_SAMPLES_PER_PIXEL], encode_lut[pixels[x] & 0x1FF][phase],
+                   sizeof(float) * NTSC_SAMPLES_PER_PIXEL);
+        }
+
+        for (int x = 0; x < ntsc->out_width; x++)
+        {
+            const int center = x * NTSC_LINE_SAMPLES / ntsc->out_width;
+            const int begin = center - NTSC_LINE_PAD;
+            out[x] = NtscDecodePixel(&line_signal[begin], (line_phase + begin + 12) % 12);
+        }
+    }
+}
+
+// Hand the pending frame to the workers, expects ntsc->lock to be held
+static void NtscStartJob(NtscFilter *ntsc)
+{
+    uint16_t *tmp = ntsc->working;
+    ntsc->working = ntsc->pending;
+    ntsc->pending = tmp;
+    ntsc->working_phase = ntsc->pending_phase;
+    ntsc->has_pending = false;
+    ntsc->active = ntsc->num_threads;
+    ++ntsc->job;
+    SDL_BroadcastCondition(ntsc->work_cond);
+}
+
+static int NtscWorkerThread(void *data)
+{
+    NtscWorker *worker = data;
+    NtscFilter *ntsc = worker->ntsc;
+
+    SDL_LockMutex(ntsc->lock);
+    while (true)
+    {
+        while (!ntsc->quit && worker->job == ntsc->job)
+            SDL_WaitCondition(ntsc->work_cond, ntsc->lock);
+
+        if (ntsc->quit)
+            break;
+
+        worker->job = ntsc->job;
+        const uint16_t *input = ntsc->working;
+        uint32_t *output = ntsc->outputs[0];
+        const int phase = ntsc->working_phase;
+        SDL_UnlockMutex(ntsc->lock);
+
+        NtscFilterLines(ntsc, input, output, phase, worker->first_line, worker->last_line);
+
+        SDL_LockMutex(ntsc->lock);
+        // Last band done, publish the frame and pick up the next one if it's already waiting
+        if (!--ntsc->active)
+        {
+            uint32_t *tmp = ntsc->outputs[1];
+            ntsc->outputs[1] = ntsc->outputs[0];
+            ntsc->outputs[0] = tmp;
+            ++ntsc->frames;
+
+            if (ntsc->has_pending)
+                NtscStartJob(ntsc);
+        }
+    }
+    SDL_UnlockMutex(ntsc->lock);
+
+    return 0;
+}
+
+// NULL if anything can't be allocated or started
+NtscFilter *NtscCreate(int scale, int num_threads)
+{
+    NtscBuildTables();
+
+    if (num_threads <= 0)
+        num_threads = SDL_GetNumLogicalCPUCores() - 1;
+
+    NtscFilter *ntsc = calloc(1, sizeof(*ntsc));
+    if (!ntsc)
+        return NULL;
+
+    ntsc->scale = MIN(MAX(scale, NTSC_MIN_SCALE), NTSC_MAX_SCALE);
+    ntsc->out_width = SCREEN_WIDTH * ntsc->scale;
+    ntsc->num_threads = MIN(MAX(num_threads, 1), NTSC_MAX_THREADS);
+
+    const size_t index_size = sizeof(uint16_t) * SCREEN_WIDTH * SCREEN_HEIGHT;
+    const size_t output_size = sizeof(uint32_t) * ntsc->out_width * SCREEN_HEIGHT;
+    ntsc->pending = calloc(1, index_size);
+    ntsc->working = calloc(1, index_size);
+    ntsc->outputs[0] = calloc(1, output_size);
+    ntsc->outputs[1] = calloc(1, output_size);
+
+    ntsc->lock = SDL_CreateMutex();
+    ntsc->work_cond = SDL_CreateCondition();
+
+    const int num_threads_wanted = ntsc->num_threads;
+    ntsc->num_threads = 0;
+    if (!ntsc->pending || !ntsc->working || !ntsc->outputs[0] || !ntsc->outputs[1] || !ntsc->lock || !ntsc->work_cond)
+    {
+        NtscDestroy(ntsc);
+        return NULL;
+    }
+
+    for (int i = 0; i < num_threads_wanted; i++)
+    {
+        NtscWorker *worker = &ntsc->workers[i];
+        worker->ntsc = ntsc;
+        worker->first_line = SCREEN_HEIGHT * i / num_threads_wanted;
+        worker->last_line = SCREEN_HEIGHT * (i + 1) / num_threads_wanted;
+        ntsc->threads[i] = SDL_CreateThread(NtscWorkerThread, "nones_ntsc", worker);
+        // Every worker has to check in for a frame to finish, a missing one would stall it for good
+        if (!ntsc->threads[i])
+        {
+            NtscDestroy(ntsc);
+            return NULL;
+        }
+        ntsc->num_threads = i + 1;
+    }
+
+    return ntsc;
+}
+
+void NtscDestroy(NtscFilter *ntsc)
+{
+    if (!ntsc)
+        return;
+
+    SDL_LockMutex(ntsc->lock);
+    ntsc->quit = true;
+    SDL_BroadcastCondition(ntsc->work_cond);
+    SDL_UnlockMutex(ntsc->lock);
+
+    for (int i = 0; i < ntsc->num_threads; i++)
+        SDL_WaitThread(ntsc->threads[i], NULL);
+
+    SDL_DestroyCondition(ntsc->work_cond);
+    SDL_DestroyMutex(ntsc->lock);
+
+    free(ntsc->pending);
+    free(ntsc->working);
+    free(ntsc->outputs[0]);
+    free(ntsc->outputs[1]);
+    free(ntsc);
+}
+
+// Called from the emulation thread, only copies the frame and wakes up the workers.
+// If the workers are still busy the previous pending frame gets replaced.
+void NtscSubmitFrame(NtscFilter *ntsc, const uint16_t *indices, uint64_t ppu_frame)
+{
+    SDL_LockMutex(ntsc->lock);
+
+    memcpy(ntsc->pending, indices, sizeof(uint16_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
+    // Odd frames are one dot shorter, which shifts the subcarrier by 4 samples
+    ntsc->pending_phase = (ppu_frame & 1) * 4;
+    ntsc->has_pending = true;
+
+    if (!ntsc->active)
+        NtscStartJob(ntsc);
+
+    SDL_UnlockMutex(ntsc->lock);
+}
+
+// Copy the last filtered frame (out_width x SCREEN_HEIGHT), dst_pitch is in bytes
+bool NtscReadFrame(NtscFilter *ntsc, uint32_t *dst, int dst_pitch)
+{
+    SDL_LockMutex(ntsc->lock);
+
+    if (!ntsc->frames)
+    {
+        SDL_UnlockMutex(ntsc->lock);
+        return false;
+    }
+
+    const size_t row_size = sizeof(uint32_t) * ntsc->out_width;
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+        memcpy((uint8_t *)dst + y * dst_pitch, &ntsc->outputs[1][y * ntsc->out_width], row_size);
+
+    SDL_UnlockMutex(ntsc->lock);
+
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef NTSC_H
+#define NTSC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL.h>
+
+#define NTSC_MIN_SCALE 2
+#define NTSC_MAX_SCALE 3
+#define NTSC_MAX_THREADS 8
+
+// Composite samples generated per PPU pixel
+#define NTSC_SAMPLES_PER_PIXEL 8
+// The decoder integrates over one full color subcarrier cycle (12 samples)
+#define NTSC_DECODE_WINDOW 12
+
+struct NtscFilter;
+
+typedef struct
+{
+    struct NtscFilter *ntsc;
+    int first_line;
+    int last_line;
+    uint64_t job;
+} NtscWorker;
+
+typedef struct NtscFilter
+{
+    int scale;
+    int out_width;
+    int num_threads;
+
+    // Frame waiting for the workers and the frame being filtered,
+    // entries are the PPU's color index | emphasis << 6
+    uint16_t *pending;
+    uint16_t *working;
+    int pending_phase;
+    int working_phase;
+    bool has_pending;
+
+    // outputs[0] is written by the workers, outputs[1] is the last finished frame
+    uint32_t *outputs[2];
+    uint64_t frames;
+
+    SDL_Mutex *lock;
+    SDL_Condition *work_cond;
+    SDL_Thread *threads[NTSC_MAX_THREADS];
+    NtscWorker workers[NTSC_MAX_THREADS];
+    uint64_t job;
+    int active;
+    bool quit;
+} NtscFilter;
+
+NtscFilter *NtscCreate(int scale, int num_threads);
+void NtscDestroy(NtscFilter *ntsc);
+void NtscSubmitFrame(NtscFilter *ntsc, const uint16_t *indices, uint64_t ppu_frame);
+bool NtscReadFrame(NtscFilter *ntsc, uint32_t *dst, int dst_pitch);
+
+#endif
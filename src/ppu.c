@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,11 +19,22 @@
 #include "nones.h"
 #include "utils.h"
 
+static_assert(FIELD_END(Ppu, io_bus) <= PPU_HOT_CACHE_LINES * CACHE_LINE_SIZE, "Ppu per dot state outgrew PPU_HOT_CACHE_LINES");
+
 static uint8_t vram[0x800];
 // Pointers to handle mirroring
 static uint8_t *nametables[4];
 // OAM Secondary
 static Sprite sprites_secondary[8];
+// Sprite index per visible scanline, bit n is set when OAM sprite n covers the line
+static uint64_t sprite_line_masks[SCREEN_HEIGHT];
+// Sprite height the index was built for (0 = needs a rebuild)
+static int sprite_line_height;
+// Sprites for the next scanline, rasterised once the fetches are done
+static SpriteLinePixel sprite_line[SCREEN_WIDTH];
+// PpuDotAction flags for every dot of each scanline class
+static uint16_t dot_actions[PPU_LINE_CLASS_COUNT][341];
+static uint8_t line_classes[262];
 static uint8_t palette_table[32];
 
 static Color sys_palette[64] =
@@ -93,7 +105,7 @@ static Color sys_palette[64] =
     {0x00, 0x00, 0x00}
 };
 
-static Color GetBGColor(Ppu *ppu, const uint8_t palette_index, const uint8_t pixel)
+static uint8_t GetBGColor(Ppu *ppu, const uint8_t palette_index, const uint8_t pixel)
 {
     // Compute palette memory address
     const uint16_t palette_addr = 0x3F00 + (palette_index * 4) + pixel;
@@ -111,10 +123,10 @@ static Color GetBGColor(Ppu *ppu, const uint8_t palette_index, const uint8_t pix
         color_index &= 0x30;
     }
 
-    return sys_palette[color_index & 0x3F];
+    return color_index & 0x3F;
 }
 
-static Color GetSpriteColor(Ppu *ppu, const uint8_t palette_index, const uint8_t pixel)
+static uint8_t GetSpriteColor(Ppu *ppu, const uint8_t palette_index, const uint8_t pixel)
 {
     const uint16_t palette_addr = 0x10 + (palette_index * 4) + pixel;
     uint16_t color_index = palette_table[palette_addr];
@@ -124,7 +136,7 @@ static Color GetSpriteColor(Ppu *ppu, const uint8_t palette_index, const uint8_t
         color_index &= 0x30;
     }
 
-    return sys_palette[color_index & 0x3F];
+    return color_index & 0x3F;
 }
 
 void PPU_WriteAddrReg(Ppu *ppu, const uint8_t value)
@@ -142,7 +154,7 @@ void PPU_WriteAddrReg(Ppu *ppu, const uint8_t value)
         ppu->t.writing.low = value;
         // Transfer t to v
         ppu->v.raw = ppu->t.raw;
-        if (~prev_a12 & ppu->v.raw_bits.bit12)
+        if (ppu->a12_watch && (~prev_a12 & ppu->v.raw_bits.bit12))
             PpuClockMMC3();
     }
     ppu->w = !ppu->w;
@@ -158,6 +170,42 @@ static uint8_t PpuNametableRead(Ppu *ppu, uint16_t addr)
     return nametables[ppu->v.scrolling.name_table_sel][addr & 0x3FF];
 }
 
+static void PpuIndexSprite(const int n, const uint8_t y, const bool add)
+{
+    const uint64_t bit = 1ULL << n;
+    const int end = MIN(y + sprite_line_height, SCREEN_HEIGHT);
+
+    for (int line = y; line < end; line++)
+    {
+        if (add)
+            sprite_line_masks[line] |= bit;
+        else
+            sprite_line_masks[line] &= ~bit;
+    }
+}
+
+static void PpuRebuildSpriteIndex(Ppu *ppu)
+{
+    memset(sprite_line_masks, 0, sizeof(sprite_line_masks));
+    sprite_line_height = ppu->ctrl.sprite_size ? 16 : 8;
+
+    for (int n = 0; n < 64; n++)
+        PpuIndexSprite(n, ppu->sprites[n].y, true);
+}
+
+static void PpuWriteOam(Ppu *ppu, const uint8_t addr, const uint8_t data)
+{
+    Sprite *sprite = &ppu->sprites[addr >> 2];
+
+    // Only the y byte affects which scanlines the sprite covers
+    if ((addr & 3) == 0 && sprite_line_height && sprite->y != data)
+    {
+        PpuIndexSprite(addr >> 2, sprite->y, false);
+        PpuIndexSprite(addr >> 2, data, true);
+    }
+    sprite->raw[addr & 3] = data;
+}
+
 // Horizontal scrolling
 static void IncX(Ppu *ppu)
 {
@@ -215,10 +263,29 @@ static void WriteToPaletteTable(const uint16_t addr, const uint8_t data)
     palette_table[effective_addr] = data;
 }
 
+// With the common pattern table layout the counter is clocked at a known dot every line,
+// so fetches only need checking when the layout is unusual or has just changed
+static void PpuUpdateA12Mode(Ppu *ppu)
+{
+    if (!ppu->a12_watch)
+        ppu->a12_mode = PPU_A12_IGNORED;
+    else if (!ppu->ctrl.bg_pat_table_addr && ppu->ctrl.sprite_pat_table_addr && !ppu->ctrl.sprite_size)
+        ppu->a12_mode = PPU_A12_PREDICTED;
+    else
+        ppu->a12_mode = PPU_A12_EDGES;
+
+    // The last fetch may have used the old layout
+    ppu->a12_check = ppu->a12_mode != PPU_A12_IGNORED;
+}
+
 static void PPU_WriteCtrl(Ppu *ppu, const uint8_t data)
 {
     ppu->ctrl.raw = data;
     ppu->t.scrolling.name_table_sel = data & 0x3;
+    // Sprite height changed, the scanline index has to be rebuilt
+    if (sprite_line_height != (ppu->ctrl.sprite_size ? 16 : 8))
+        sprite_line_height = 0;
+    PpuUpdateA12Mode(ppu);
     //printf("PPU_WriteCtrl: NMI: %d scanline:%d cycle: %d\n", ppu->ctrl.vblank_nmi, ppu->scanline, ppu->cycle_counter);
 }
 
@@ -261,7 +328,7 @@ void PPU_WriteData(Ppu *ppu, const uint8_t data)
     {
         ppu->v.raw += ppu->ctrl.vram_addr_inc ? 32 : 1;
     }
-    if (~prev_a12 & ppu->v.raw_bits.bit12)
+    if (ppu->a12_watch && (~prev_a12 & ppu->v.raw_bits.bit12))
         PpuClockMMC3();
 }
 
@@ -298,12 +365,14 @@ uint8_t PPU_ReadStatus(Ppu *ppu)
 
 static uint8_t PpuReadChr(Ppu *ppu, const uint16_t addr)
 {
-    uint8_t prev_a12 = (ppu->bus_addr >> 12) & 1;
-    uint8_t new_a12 = (addr >> 12) & 1;
-    if (~prev_a12 & new_a12)
+    if (ppu->a12_check)
     {
-        //printf("PPU A12: %d scanline:%d cycle: %d\n", new_a12, ppu->scanline, ppu->cycle_counter);
-        PpuClockMMC3();
+        if (~ppu->bus_addr & addr & 0x1000)
+        {
+            //printf("PPU A12: %d scanline:%d cycle: %d\n", (addr >> 12) & 1, ppu->scanline, ppu->cycle_counter);
+            PpuClockMMC3();
+        }
+        ppu->a12_check = ppu->a12_mode == PPU_A12_EDGES;
     }
     ppu->bus_addr = addr;
     return PpuBusReadChrRom(addr);
@@ -356,7 +425,7 @@ uint8_t PPU_ReadData(Ppu *ppu)
         ppu->v.raw += ppu->ctrl.vram_addr_inc ? 32 : 1;
     }
 
-    if (~prev_a12 & ppu->v.raw_bits.bit12)
+    if (ppu->a12_watch && (~prev_a12 & ppu->v.raw_bits.bit12))
         PpuClockMMC3();
     return data;
 }
@@ -402,7 +471,7 @@ void WritePPURegister(Ppu *ppu, const uint16_t addr, const uint8_t data)
         {
             if (!ppu->rendering || (ppu->scanline > 239 && ppu->scanline < 261))
             {
-                ppu->sprites[ppu->oam_addr >> 2].raw[ppu->oam_addr & 3] = data;
+                PpuWriteOam(ppu, ppu->oam_addr, data);
                 ++ppu->oam_addr;
             }
             else
@@ -456,6 +525,52 @@ void PpuSetMirroring(NameTableMirror mode, int page)
     }
 }
 
+static void PpuBuildDotTable(void)
+{
+    for (int scanline = 0; scanline < 262; scanline++)
+    {
+        if (scanline < 240)
+            line_classes[scanline] = PPU_LINE_VISIBLE;
+        else if (scanline == 240)
+            line_classes[scanline] = PPU_LINE_POST_RENDER;
+        else if (scanline == 241)
+            line_classes[scanline] = PPU_LINE_VBLANK_START;
+        else if (scanline < 261)
+            line_classes[scanline] = PPU_LINE_VBLANK;
+        else
+            line_classes[scanline] = PPU_LINE_PRE_RENDER;
+    }
+
+    memset(dot_actions, 0, sizeof(dot_actions));
+
+    for (int cycle = 0; cycle < 341; cycle++)
+    {
+        uint16_t render_line = 0;
+
+        if (cycle && (cycle <= 257 || (cycle >= 321 && cycle <= 336)))
+            render_line |= PPU_DOT_RENDER;
+        if (cycle >= 257 && cycle <= 320)
+            render_line |= PPU_DOT_SPRITE_FETCH;
+        if (cycle == 256)
+            render_line |= PPU_DOT_INC_Y;
+        if (cycle == 257)
+            render_line |= PPU_DOT_COPY_X;
+
+        dot_actions[PPU_LINE_VISIBLE][cycle] = render_line;
+        dot_actions[PPU_LINE_PRE_RENDER][cycle] = render_line;
+
+        if (cycle == 64)
+            dot_actions[PPU_LINE_VISIBLE][cycle] |= PPU_DOT_CLEAR_OAM;
+        if (cycle == 256)
+            dot_actions[PPU_LINE_VISIBLE][cycle] |= PPU_DOT_SPRITE_EVAL;
+        if (cycle >= 280 && cycle < 305)
+            dot_actions[PPU_LINE_PRE_RENDER][cycle] |= PPU_DOT_COPY_Y;
+    }
+
+    dot_actions[PPU_LINE_VBLANK_START][1] = PPU_DOT_VBLANK_SET;
+    dot_actions[PPU_LINE_PRE_RENDER][1] |= PPU_DOT_VBLANK_CLEAR;
+}
+
 void PPU_Init(Ppu *ppu, int name_table_layout, uint32_t **buffers)
 {
     memset(ppu, 0, sizeof(*ppu));
@@ -465,15 +580,96 @@ void PPU_Init(Ppu *ppu, int name_table_layout, uint32_t **buffers)
     ppu->buffers[0] = buffers[0];
     ppu->buffers[1] = buffers[1];
     ppu->ext_input = 0;
+    sprite_line_height = 0;
+    PpuBuildDotTable();
     //ppu->status.open_bus = 0x1c;
 }
 
-static void DrawPixel(uint32_t *buffer, int x, int y, Color color)
+// Pass NULL to stop recording color indices
+void PPU_SetIndexBuffers(Ppu *ppu, uint16_t **buffers)
+{
+    ppu->index_buffers[0] = buffers ? buffers[0] : NULL;
+    ppu->index_buffers[1] = buffers ? buffers[1] : NULL;
+}
+
+// Set by the system when the cart's mapper counts A12 rising edges
+void PPU_SetA12Watch(Ppu *ppu, bool watch)
+{
+    ppu->a12_watch = watch;
+    PpuUpdateA12Mode(ppu);
+}
+
+// The frame buffers stay the frontend's, everything else is restored
+void PPU_StateSync(Ppu *ppu, State *state)
+{
+    STATE_FIELD(state, ppu->sprites);
+    STATE_FIELD(state, ppu->fifo);
+    STATE_FIELD(state, ppu->cycles);
+    STATE_FIELD(state, ppu->frames);
+    STATE_FIELD(state, ppu->cycles_to_run);
+    STATE_FIELD(state, ppu->cycle_counter);
+    STATE_FIELD(state, ppu->scanline);
+    STATE_FIELD(state, ppu->bus_addr);
+    STATE_FIELD(state, ppu->a12_watch);
+    STATE_FIELD(state, ppu->a12_mode);
+    STATE_FIELD(state, ppu->a12_check);
+    STATE_FIELD(state, ppu->v);
+    STATE_FIELD(state, ppu->t);
+    STATE_FIELD(state, ppu->x);
+    STATE_FIELD(state, ppu->w);
+    STATE_FIELD(state, ppu->nt_mirror_mode);
+    STATE_FIELD(state, ppu->ext_input);
+    STATE_FIELD(state, ppu->bg_shift_low);
+    STATE_FIELD(state, ppu->bg_shift_high);
+    STATE_FIELD(state, ppu->attrib_shift_low);
+    STATE_FIELD(state, ppu->attrib_shift_high);
+    STATE_FIELD(state, ppu->found_sprites);
+    STATE_FIELD(state, ppu->sprite0_loaded);
+    STATE_FIELD(state, ppu->rendering);
+    STATE_FIELD(state, ppu->clear_vblank);
+    STATE_FIELD(state, ppu->frame_finished);
+    STATE_FIELD(state, ppu->ctrl);
+    STATE_FIELD(state, ppu->mask);
+    STATE_FIELD(state, ppu->status);
+    STATE_FIELD(state, ppu->oam_addr);
+    STATE_FIELD(state, ppu->buffered_data);
+    STATE_FIELD(state, ppu->attrib_data);
+    STATE_FIELD(state, ppu->tile_id);
+    STATE_FIELD(state, ppu->bg_lsb);
+    STATE_FIELD(state, ppu->bg_msb);
+    STATE_FIELD(state, ppu->io_bus);
+
+    STATE_FIELD(state, vram);
+    STATE_FIELD(state, palette_table);
+    STATE_FIELD(state, sprites_secondary);
+    STATE_FIELD(state, sprite_line);
+
+    // Mirroring as offsets into vram
+    uint16_t nametable_offsets[4];
+    for (int i = 0; i < 4; i++)
+        nametable_offsets[i] = (uint16_t)(nametables[i] - vram);
+    STATE_FIELD(state, nametable_offsets);
+
+    if (state->loading)
+    {
+        for (int i = 0; i < 4; i++)
+            nametables[i] = &vram[nametable_offsets[i] & 0x7FF];
+        // The sprite index is rebuilt from OAM
+        sprite_line_height = 0;
+    }
+}
+
+static void DrawPixel(Ppu *ppu, int x, int y, const uint8_t color_index)
 {
     if (x < 0 || y < 0 || x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT)
         return;
 
-    buffer[y * SCREEN_WIDTH + x] = (uint32_t)((color.r << 24) | (color.g << 16) | (color.b << 8) | 255);
+    const Color color = sys_palette[color_index];
+    ppu->buffers[0][y * SCREEN_WIDTH + x] = (uint32_t)((color.r << 24) | (color.g << 16) | (color.b << 8) | 255);
+
+    // Keep the raw color index and emphasis bits around for the NTSC filter
+    if (ppu->index_buffers[0])
+        ppu->index_buffers[0][y * SCREEN_WIDTH + x] = color_index | ((ppu->mask.raw >> 5) << 6);
 }
 
 static void ResetSecondaryOAMSprites(void)
@@ -484,38 +680,33 @@ static void ResetSecondaryOAMSprites(void)
 static void PpuUpdateSprites(Ppu *ppu)
 {
     ppu->found_sprites = 0;
-    ppu->sprite0_loaded = false;
 
-    for (int n = 0; n < 64; n++)
-    {
-        Sprite curr_sprite = ppu->sprites[n];
-        if (ppu->scanline >= curr_sprite.y && ppu->scanline < curr_sprite.y + (ppu->ctrl.sprite_size ? 16 : 8))
-        {
-            if (ppu->found_sprites == 8)
-            {
-                ppu->status.sprite_overflow = 1;
-                break;
-            }
+    if (!sprite_line_height)
+        PpuRebuildSpriteIndex(ppu);
 
-            if (!n)
-            {
-                //printf("Found sprite 0 at y:%d\n", ppu->scanline);
-                //printf("sprite0.y: %d sprite0.x: %d\n", curr_sprite.y, curr_sprite.x);
-                ppu->sprite0_loaded = true;
-            }
+    uint64_t mask = sprite_line_masks[ppu->scanline];
+
+    // Sprite 0 is always the lowest set bit
+    ppu->sprite0_loaded = mask & 1;
 
-            //printf("Found sprite %d at y:%d\n", found_sprites, ppu->scanline);
-            sprites_secondary[ppu->found_sprites++] = curr_sprite;
+    // Walk the sprites on this line in OAM order
+    while (mask)
+    {
+        if (ppu->found_sprites == 8)
+        {
+            ppu->status.sprite_overflow = 1;
+            break;
         }
+
+        const int n = __builtin_ctzll(mask);
+        sprites_secondary[ppu->found_sprites++] = ppu->sprites[n];
+        mask &= mask - 1;
     }
 }
 
-static void PpuHandleSprite0Hit(Ppu *ppu, const int xpos, const int fifo_lane, const uint8_t bg_pixel, const uint8_t sprite_pixel)
+static void PpuHandleSprite0Hit(Ppu *ppu, const int xpos, const uint8_t bg_pixel)
 {
-    if (!bg_pixel || !sprite_pixel)
-        return;
-
-    if (fifo_lane != 0 || !ppu->sprite0_loaded)
+    if (!bg_pixel)
         return;
 
     if (!ppu->mask.bg_rendering || ppu->status.sprite_hit)
@@ -531,50 +722,53 @@ static void PpuHandleSprite0Hit(Ppu *ppu, const int xpos, const int fifo_lane, c
     ppu->status.sprite_hit = inside_sprite0 && sprite_0_hit_inrange;
 }
 
+// Rasterise the fetched sprite lanes into the line buffer, lower lanes win
+static void PpuRasterizeSprites(Ppu *ppu)
+{
+    memset(sprite_line, 0, sizeof(sprite_line));
+
+    for (int i = 0; i < ppu->found_sprites; i++)
+    {
+        const SpriteFifo *fifo_lane = &ppu->fifo[i];
+        const int end = MIN(fifo_lane->x + 8, SCREEN_WIDTH);
+
+        for (int xpos = fifo_lane->x; xpos < end; xpos++)
+        {
+            SpriteLinePixel *dst = &sprite_line[xpos];
+            if (dst->pixel)
+                continue;
+
+            const int k = xpos - fifo_lane->x;
+            const uint8_t bit = fifo_lane->attribs.horz_flip ? k : 7 - k;
+            const uint8_t spixel_low  = (fifo_lane->shift.low >> bit) & 1;
+            const uint8_t spixel_high = (fifo_lane->shift.high >> bit) & 1;
+
+            dst->pixel = (spixel_high << 1) | spixel_low;
+            dst->palette = fifo_lane->attribs.palette;
+            dst->priority = fifo_lane->attribs.priority;
+            dst->sprite0 = !i && ppu->sprite0_loaded;
+        }
+    }
+}
+
 static void PpuRenderSpritePixel(Ppu *ppu, const int xpos, const uint8_t bg_pixel)
 {
-    if (!ppu->mask.sprites_rendering)
+    if (!ppu->mask.sprites_rendering || !ppu->scanline)
         return;
 
-    const int scanline = ppu->scanline;
-    const bool sprite_inrange = (ppu->mask.show_sprites_left_corner || xpos > 7);
+    if (!ppu->mask.show_sprites_left_corner && xpos < 8)
+        return;
 
-    uint8_t sprite_pixel = 0;
+    const SpriteLinePixel sprite = sprite_line[xpos];
+    if (!sprite.pixel)
+        return;
 
-    for (int i = 0; i < ppu->found_sprites; i++)
-    {
-        SpriteFifo *fifo_lane = &ppu->fifo[i];
-        if (fifo_lane->x > 0)
-            --fifo_lane->x;
-        else
-        {
-            if (!sprite_pixel && scanline && sprite_inrange)
-            {
-                const uint8_t bit = !fifo_lane->attribs.horz_flip * 7;
-                uint8_t spixel_low  = (fifo_lane->shift.low >> bit) & 1;
-                uint8_t spixel_high = (fifo_lane->shift.high >> bit) & 1;
-                sprite_pixel = (spixel_high << 1) | spixel_low;
-
-                PpuHandleSprite0Hit(ppu, xpos, i, bg_pixel, sprite_pixel);
-
-                if (sprite_pixel && (!fifo_lane->attribs.priority || !bg_pixel))
-                {
-                    Color color = GetSpriteColor(ppu, fifo_lane->attribs.palette, sprite_pixel);
-                    DrawPixel(ppu->buffers[0], xpos, scanline, color);
-                }
-            }
+    if (sprite.sprite0)
+        PpuHandleSprite0Hit(ppu, xpos, bg_pixel);
 
-            if (fifo_lane->attribs.horz_flip)
-            {
-                fifo_lane->shift.low >>= 1;
-                fifo_lane->shift.high >>= 1;
-            }
-            else
-            {
-                fifo_lane->shift.low <<= 1;
-                fifo_lane->shift.high <<= 1;
-            }
-        }
+    if (!sprite.priority || !bg_pixel)
+    {
+        DrawPixel(ppu, xpos, ppu->scanline, GetSpriteColor(ppu, sprite.palette, sprite.pixel));
     }
 }
 
@@ -671,13 +865,11 @@ static void PpuRender(Ppu *ppu, int scanline, int cycle)
 
         if (draw_bg)
         {
-            Color color = GetBGColor(ppu, bg_palette, bg_pixel);
-            DrawPixel(ppu->buffers[0], xpos, scanline, color);
+            DrawPixel(ppu, xpos, scanline, GetBGColor(ppu, bg_palette, bg_pixel));
         }
         else
         {
-            Color color = GetBGColor(ppu, bg_palette, 0);
-            DrawPixel(ppu->buffers[0], xpos, scanline, color);
+            DrawPixel(ppu, xpos, scanline, GetBGColor(ppu, bg_palette, 0));
         }
 
         PpuRenderSpritePixel(ppu, xpos, bg_pixel);
@@ -720,6 +912,9 @@ static void PpuFetchSprite(Ppu *ppu, int sprite_num)
         }
         case 5:
         {
+            // The background fetches before this one are all below $1000
+            if (sprite_num == 0 && ppu->a12_mode == PPU_A12_PREDICTED)
+                ppu->a12_check = true;
             // Bitplane 0
             ppu->fifo[sprite_num].shift.low = PpuReadChr(ppu, PpuGetSpriteAddr(ppu, curr_sprite));
             break;
@@ -728,77 +923,85 @@ static void PpuFetchSprite(Ppu *ppu, int sprite_num)
         {
             // Bitplane 1
             ppu->fifo[sprite_num].shift.high = PpuReadChr(ppu, PpuGetSpriteAddr(ppu, curr_sprite) + 8);
+            // Last fetch of the scanline
+            if (sprite_num == 7)
+                PpuRasterizeSprites(ppu);
             break;
         }
     }
 }
 
-void PPU_Tick(Ppu *ppu)
+static void PpuRunDotActions(Ppu *ppu, const uint16_t actions)
 {
-    ppu->cycles_to_run += 3;
+    if (actions & PPU_DOT_RENDER)
+        PpuRender(ppu, ppu->scanline, ppu->cycle_counter);
 
-    while (ppu->cycles_to_run > 0)
-    {
-        if (ppu->cycles_to_run == 2)
-        {
-            //printf("Nmi polled: frame:%ld scanline:%d cycle:%d\n", ppu->frames, ppu->scanline, ppu->cycle_counter);
-            SystemPollNmi();
-        }
+    if (actions & PPU_DOT_CLEAR_OAM)
+        ResetSecondaryOAMSprites();
 
-        if (ppu->cycle_counter && (ppu->scanline < 240 || ppu->scanline == 261) && (ppu->cycle_counter <= 257 || (ppu->cycle_counter >= 321 && ppu->cycle_counter <= 336)))
-            PpuRender(ppu, ppu->scanline, ppu->cycle_counter);
+    if (ppu->rendering && (actions & PPU_DOT_SPRITE_EVAL))
+        PpuUpdateSprites(ppu);
 
-        if (ppu->cycle_counter == 64 && ppu->scanline < 240)
-        {
-            ResetSecondaryOAMSprites();
-        }
+    if (actions & PPU_DOT_SPRITE_FETCH)
+    {
+        ppu->oam_addr *= !ppu->rendering;
+        PpuFetchSprite(ppu, (ppu->cycle_counter - 257) >> 3);
+    }
 
-        if (ppu->rendering && ppu->cycle_counter == 256 && (ppu->scanline < 240))
-        {
-            PpuUpdateSprites(ppu);
-        }
+    if (ppu->rendering && (actions & PPU_DOT_INC_Y))
+        IncY(ppu);
 
-        if ((ppu->cycle_counter <= 320 && ppu->cycle_counter >= 257) && (ppu->scanline < 240 || ppu->scanline == 261))
-        {
-            ppu->oam_addr *= !ppu->rendering;
-            PpuFetchSprite(ppu, (ppu->cycle_counter - 257) >> 3);
-        }
+    if (ppu->rendering && (actions & PPU_DOT_COPY_X))
+    {
+        ppu->v.scrolling.coarse_x = ppu->t.scrolling.coarse_x;
+        ppu->v.raw_bits.bit10 = ppu->t.raw_bits.bit10;
+    }
 
-        if (ppu->rendering && ppu->cycle_counter == 256 && (ppu->scanline < 240 || ppu->scanline == 261))
-            IncY(ppu);
+    if (actions & PPU_DOT_VBLANK_SET)
+    {
+        //printf("PPU v addr: 0x%04X\n", ppu->v.raw);
+        ppu->bus_addr = ppu->v.raw & 0x3FFF;
+        // Vblank starts at scanline 241
+        ppu->status.vblank = 1;
+        // Copy the finished image in the back buffer to the front buffer
+        memcpy(ppu->buffers[1], ppu->buffers[0], sizeof(uint32_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
+        if (ppu->index_buffers[0])
+            memcpy(ppu->index_buffers[1], ppu->index_buffers[0], sizeof(uint16_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
+    }
 
-        if (ppu->rendering && ppu->cycle_counter == 257 && (ppu->scanline < 240 || ppu->scanline == 261))
-        {
-            ppu->v.scrolling.coarse_x = ppu->t.scrolling.coarse_x;
-            ppu->v.raw_bits.bit10 = ppu->t.raw_bits.bit10;
-        }
+    // Clear VBlank flag at scanline 261, dot 1
+    if (actions & PPU_DOT_VBLANK_CLEAR)
+    {
+        ppu->status.vblank = 0;
+        ppu->status.sprite_hit = 0;
+        ppu->status.sprite_overflow = 0;
+    }
 
-        if (ppu->scanline == 241 && ppu->cycle_counter == 1)
-        {
-            //printf("PPU v addr: 0x%04X\n", ppu->v.raw);
-            ppu->bus_addr = ppu->v.raw & 0x3FFF;
-            // Vblank starts at scanline 241
-            ppu->status.vblank = 1;
-            // Copy the finished image in the back buffer to the front buffer
-            memcpy(ppu->buffers[1], ppu->buffers[0], sizeof(uint32_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
-        }
+    if (ppu->rendering && (actions & PPU_DOT_COPY_Y))
+    {
+        // reset scroll
+        ppu->v.scrolling.coarse_y = ppu->t.scrolling.coarse_y;
+        ppu->v.scrolling.fine_y = ppu->t.scrolling.fine_y;
+        ppu->v.raw_bits.bit11 = ppu->t.raw_bits.bit11;
+    }
+}
 
-        // Clear VBlank flag at scanline 261, dot 1
-        if (ppu->scanline == 261 && ppu->cycle_counter == 1)
-        {
-            ppu->status.vblank = 0;
-            ppu->status.sprite_hit = 0;
-            ppu->status.sprite_overflow = 0;
-        }
+void PPU_Tick(Ppu *ppu)
+{
+    ppu->cycles_to_run += 3;
 
-        if (ppu->rendering && ppu->scanline == 261 && (ppu->cycle_counter >= 280 && ppu->cycle_counter < 305))
+    while (ppu->cycles_to_run > 0)
+    {
+        if (ppu->cycles_to_run == 2)
         {
-            // reset scroll
-            ppu->v.scrolling.coarse_y = ppu->t.scrolling.coarse_y;
-            ppu->v.scrolling.fine_y = ppu->t.scrolling.fine_y;
-            ppu->v.raw_bits.bit11 = ppu->t.raw_bits.bit11;
+            //printf("Nmi polled: frame:%ld scanline:%d cycle:%d\n", ppu->frames, ppu->scanline, ppu->cycle_counter);
+            SystemPollNmi();
         }
 
+        const uint16_t actions = dot_actions[line_classes[ppu->scanline]][ppu->cycle_counter];
+        if (actions)
+            PpuRunDotActions(ppu, actions);
+
         ppu->cycle_counter = (ppu->cycle_counter + 1) % 341;
         ++ppu->cycles;
         --ppu->cycles_to_run;
@@ -857,4 +1060,5 @@ void PPU_Reset(Ppu *ppu)
     ppu->ctrl.raw = 0;
     ppu->mask.raw = 0;
     ppu->buffered_data = 0;
+    PpuUpdateA12Mode(ppu);
 }
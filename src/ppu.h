@@ -3,6 +3,7 @@
 
 // PPU mem map
 #include <stdint.h>
+#include "state.h"
 #define PPU_MM_MASK 0x3FFF
 #define CART_ADDR_START 0
 #define CART_ADDR_SIZE 0x2000
@@ -57,6 +58,41 @@ typedef enum
     PPU_PRE_RENDER = 261
 } PpuStages;
 
+typedef enum
+{
+    PPU_LINE_VISIBLE,
+    PPU_LINE_POST_RENDER,
+    PPU_LINE_VBLANK_START,
+    PPU_LINE_VBLANK,
+    PPU_LINE_PRE_RENDER,
+    PPU_LINE_CLASS_COUNT
+} PpuLineClass;
+
+// How pattern fetches are checked for the A12 rising edges MMC3 counts, see PpuUpdateA12Mode
+typedef enum
+{
+    // The mapper doesn't watch A12
+    PPU_A12_IGNORED,
+    // Background at $0000 and 8x8 sprites at $1000, A12 can only rise on the first sprite fetch of a line
+    PPU_A12_PREDICTED,
+    // Any other layout, every pattern fetch is checked
+    PPU_A12_EDGES
+} PpuA12Mode;
+
+// Work to do on a given (scanline class, dot), see PpuBuildDotTable
+typedef enum
+{
+    PPU_DOT_RENDER       = 1 << 0,
+    PPU_DOT_CLEAR_OAM    = 1 << 1,
+    PPU_DOT_SPRITE_EVAL  = 1 << 2,
+    PPU_DOT_SPRITE_FETCH = 1 << 3,
+    PPU_DOT_INC_Y        = 1 << 4,
+    PPU_DOT_COPY_X       = 1 << 5,
+    PPU_DOT_VBLANK_SET   = 1 << 6,
+    PPU_DOT_VBLANK_CLEAR = 1 << 7,
+    PPU_DOT_COPY_Y       = 1 << 8,
+} PpuDotAction;
+
 typedef union
 {
     uint8_t raw;
@@ -241,12 +277,26 @@ typedef struct
     uint8_t x;
 } SpriteFifo;
 
+// One entry of the pre-rasterised sprite line
+typedef union
+{
+    uint8_t raw;
+    struct {
+        // 0 means no opaque sprite pixel here
+        uint8_t pixel : 2;
+        uint8_t palette : 2;
+        uint8_t priority : 1;
+        // Pixel comes from sprite 0
+        uint8_t sprite0 : 1;
+        uint8_t padding : 2;
+    };
+} SpriteLinePixel;
+
+// Everything a dot touches comes first and fits in PPU_HOT_CACHE_LINES cache lines, per scanline
+// state follows, OAM and what only the CPU side or setup uses go last
 typedef struct
 {
-    Sprite sprites[64];
-    SpriteFifo fifo[8];
     int64_t cycles;
-    uint64_t frames;
     int32_t cycles_to_run;
     int32_t cycle_counter;
     int scanline;
@@ -256,6 +306,8 @@ typedef struct
     // buffer 0 is the backbuffer
     // buffer 1 is the frontbuffer
     uint32_t *buffers[2];
+    // Optional double buffer of color index | emphasis << 6 for the NTSC filter
+    uint16_t *index_buffers[2];
 
     // PPU internel regs
     struct {
@@ -270,45 +322,59 @@ typedef struct
         bool w;
     };
 
-    NameTableMirror nt_mirror_mode;
-    int ext_input;
-
     ShiftReg bg_shift_low;
     ShiftReg bg_shift_high;
     ShiftReg attrib_shift_low;
     ShiftReg attrib_shift_high;
 
-    // Per scanline
-    int found_sprites;
-    bool sprite0_loaded;
-    
-    bool rendering;
-    bool clear_vblank;
-    bool frame_finished;
+    uint8_t attrib_data;
+    uint8_t tile_id;
+    uint8_t bg_lsb;
+    uint8_t bg_msb;
 
     // External io regs for cpu
     PpuCtrl ctrl;
     PpuMask mask;
     PpuStatus status;
-    uint8_t oam_addr;
-    // Read buffer for $2007
-    uint8_t buffered_data;
 
-    uint8_t attrib_data;
-    uint8_t tile_id;
-    uint8_t bg_lsb;
-    uint8_t bg_msb;
+    bool rendering;
+    bool clear_vblank;
+    bool frame_finished;
+
+    PpuA12Mode a12_mode;
+    // Check the next pattern fetch for a rising A12 edge
+    bool a12_check;
 
     // io data bus
     uint8_t io_bus;
+
+    // Per scanline
+    int found_sprites;
+    bool sprite0_loaded;
+    SpriteFifo fifo[8];
+
+    // Cold
+    uint64_t frames;
+    uint8_t oam_addr;
+    // Read buffer for $2007
+    uint8_t buffered_data;
+    bool a12_watch;
+    NameTableMirror nt_mirror_mode;
+    int ext_input;
+    Sprite sprites[64];
 } Ppu;
 
+#define PPU_HOT_CACHE_LINES 2
+
 void PPU_Init(Ppu *ppu, int name_table_layout, uint32_t **buffers);
 void PPU_Update(Ppu *ppu, uint64_t cpu_cycles);
 void PPU_Tick(Ppu *ppu);
 void PPU_Reset(Ppu *ppu);
+void PPU_SetIndexBuffers(Ppu *ppu, uint16_t **buffers);
+void PPU_SetA12Watch(Ppu *ppu, bool watch);
 uint8_t ReadPPURegister(Ppu *ppu, const uint16_t addr);
 void WritePPURegister(Ppu *ppu, const uint16_t addr, const uint8_t data);
 void PpuSetMirroring(NameTableMirror mode, int page);
+void PPU_StateSync(Ppu *ppu, State *state);
 
 #endif
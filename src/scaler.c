@@ -0,0 +1,383 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL3/SDL.h>
+
+#include "scaler.h"
+#include "nones.h"
+#include "utils.h"
+
+// Pixels are RGBA8888 packed as 0xRRGGBBAA
+#define RED(p)   (((p) >> 24) & 0xFF)
+#define GREEN(p) (((p) >> 16) & 0xFF)
+#define BLUE(p)  (((p) >> 8) & 0xFF)
+
+static inline uint32_t ScalerPixel(const uint32_t *src, int x, int y)
+{
+    x = MIN(MAX(x, 0), SCREEN_WIDTH - 1);
+    y = MIN(MAX(y, 0), SCREEN_HEIGHT - 1);
+    return src[y * SCREEN_WIDTH + x];
+}
+
+static void ScaleNearest(const uint32_t *src, uint32_t *dst, const int factor)
+{
+    const int out_width = SCREEN_WIDTH * factor;
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+    {
+        uint32_t *row = &dst[y * factor * out_width];
+
+        for (int x = 0; x < SCREEN_WIDTH; x++)
+        {
+            const uint32_t p = src[y * SCREEN_WIDTH + x];
+            for (int i = 0; i < factor; i++)
+                row[x * factor + i] = p;
+        }
+
+        // Repeat the finished row
+        for (int i = 1; i < factor; i++)
+            memcpy(&row[i * out_width], row, sizeof(uint32_t) * out_width);
+    }
+}
+
+// AdvMAME2x / EPX
+static void ScaleScale2x(const uint32_t *src, uint32_t *dst)
+{
+    const int out_width = SCREEN_WIDTH * 2;
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+    {
+        uint32_t *row0 = &dst[(y * 2) * out_width];
+        uint32_t *row1 = row0 + out_width;
+
+        for (int x = 0; x < SCREEN_WIDTH; x++)
+        {
+            const uint32_t b = ScalerPixel(src, x, y - 1);
+            const uint32_t d = ScalerPixel(src, x - 1, y);
+            const uint32_t e = src[y * SCREEN_WIDTH + x];
+            const uint32_t f = ScalerPixel(src, x + 1, y);
+            const uint32_t h = ScalerPixel(src, x, y + 1);
+
+            if (b != h && d != f)
+            {
+                row0[x * 2]     = d == b ? d : e;
+                row0[x * 2 + 1] = b == f ? f : e;
+                row1[x * 2]     = d == h ? d : e;
+                row1[x * 2 + 1] = h == f ? f : e;
+            }
+            else
+            {
+                row0[x * 2] = row0[x * 2 + 1] = e;
+                row1[x * 2] = row1[x * 2 + 1] = e;
+            }
+        }
+    }
+}
+
+// AdvMAME3x
+static void ScaleScale3x(const uint32_t *src, uint32_t *dst)
+{
+    const int out_width = SCREEN_WIDTH * 3;
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+    {
+        uint32_t *row0 = &dst[(y * 3) * out_width];
+        uint32_t *row1 = row0 + out_width;
+        uint32_t *row2 = row1 + out_width;
+
+        for (int x = 0; x < SCREEN_WIDTH; x++)
+        {
+            const uint32_t a = ScalerPixel(src, x - 1, y - 1);
+            const uint32_t b = ScalerPixel(src, x, y - 1);
+            const uint32_t c = ScalerPixel(src, x + 1, y - 1);
+            const uint32_t d = ScalerPixel(src, x - 1, y);
+            const uint32_t e = src[y * SCREEN_WIDTH + x];
+            const uint32_t f = ScalerPixel(src, x + 1, y);
+            const uint32_t g = ScalerPixel(src, x - 1, y + 1);
+            const uint32_t h = ScalerPixel(src, x, y + 1);
+            const uint32_t i = ScalerPixel(src, x + 1, y + 1);
+
+            uint32_t *out0 = &row0[x * 3];
+            uint32_t *out1 = &row1[x * 3];
+            uint32_t *out2 = &row2[x * 3];
+
+            if (b != h && d != f)
+            {
+                out0[0] = d == b ? d : e;
+                out0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+                out0[2] = b == f ? f : e;
+                out1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+                out1[1] = e;
+                out1[2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+                out2[0] = d == h ? d : e;
+                out2[1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+                out2[2] = h == f ? f : e;
+            }
+            else
+            {
+                out0[0] = out0[1] = out0[2] = e;
+                out1[0] = out1[1] = out1[2] = e;
+                out2[0] = out2[1] = out2[2] = e;
+            }
+        }
+    }
+}
+
+// Y, U and V packed into one word so the edge detection only does table lookups
+static void ScalerBuildYuv(const uint32_t *src, uint32_t *yuv)
+{
+    for (int n = 0; n < SCREEN_WIDTH * SCREEN_HEIGHT; n++)
+    {
+        const int r = RED(src[n]);
+        const int g = GREEN(src[n]);
+        const int b = BLUE(src[n]);
+
+        const int y = (r * 77 + g * 150 + b * 29) >> 8;
+        const int u = ((b - y) * 144 >> 8) + 128;
+        const int v = ((r - y) * 183 >> 8) + 128;
+
+        yuv[n] = (uint32_t)((y << 16) | (MIN(MAX(u, 0), 255) << 8) | MIN(MAX(v, 0), 255));
+    }
+}
+
+static inline int ScalerYuvDiff(const uint32_t a, const uint32_t b)
+{
+    const int dy = abs((int)((a >> 16) & 0xFF) - (int)((b >> 16) & 0xFF));
+    const int du = abs((int)((a >> 8) & 0xFF) - (int)((b >> 8) & 0xFF));
+    const int dv = abs((int)(a & 0xFF) - (int)(b & 0xFF));
+    return 48 * dy + 7 * du + 6 * dv;
+}
+
+static inline uint32_t ScalerBlend(const uint32_t a, const uint32_t b)
+{
+    // Average of two pixels without carrying between channels
+    return (((a ^ b) & 0xFEFEFEFE) >> 1) + (a & b);
+}
+
+// One output corner of 2xBR level 1, sx/sy point from the source pixel towards the corner
+static uint32_t ScalerXbrCorner(const uint32_t *src, const uint32_t *yuv, const int x, const int y,
+                                const int sx, const int sy)
+{
+#define YUV(dx, dy) ScalerPixel(yuv, x + (dx) * sx, y + (dy) * sy)
+    const uint32_t e = src[y * SCREEN_WIDTH + x];
+    const uint32_t f = ScalerPixel(src, x + sx, y);
+    const uint32_t h = ScalerPixel(src, x, y + sy);
+
+    if (e == f || e == h)
+        return e;
+
+    const uint32_t ye = YUV(0, 0);
+    const uint32_t yf = YUV(1, 0);
+    const uint32_t yh = YUV(0, 1);
+    const uint32_t yi = YUV(1, 1);
+
+    // Weighted distance along and across the corner edge
+    const int edge = ScalerYuvDiff(ye, YUV(1, -1)) + ScalerYuvDiff(ye, YUV(-1, 1)) +
+                     ScalerYuvDiff(yi, YUV(0, 2)) + ScalerYuvDiff(yi, YUV(2, 0)) +
+                     (ScalerYuvDiff(yh, yf) << 2);
+    const int cross = ScalerYuvDiff(yh, YUV(-1, 0)) + ScalerYuvDiff(yh, YUV(1, 2)) +
+                      ScalerYuvDiff(yf, YUV(2, 1)) + ScalerYuvDiff(yf, YUV(0, -1)) +
+                      (ScalerYuvDiff(ye, yi) << 2);
+#undef YUV
+
+    if (edge >= cross)
+        return e;
+
+    const uint32_t closest = ScalerYuvDiff(ye, yf) <= ScalerYuvDiff(ye, yh) ? f : h;
+    return ScalerBlend(e, closest);
+}
+
+static void ScaleXbrLite(const uint32_t *src, uint32_t *yuv, uint32_t *dst)
+{
+    const int out_width = SCREEN_WIDTH * 2;
+
+    ScalerBuildYuv(src, yuv);
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++)
+    {
+        uint32_t *row0 = &dst[(y * 2) * out_width];
+        uint32_t *row1 = row0 + out_width;
+
+        for (int x = 0; x < SCREEN_WIDTH; x++)
+        {
+            row0[x * 2]     = ScalerXbrCorner(src, yuv, x, y, -1, -1);
+            row0[x * 2 + 1] = ScalerXbrCorner(src, yuv, x, y, 1, -1);
+            row1[x * 2]     = ScalerXbrCorner(src, yuv, x, y, -1, 1);
+            row1[x * 2 + 1] = ScalerXbrCorner(src, yuv, x, y, 1, 1);
+        }
+    }
+}
+
+static void ScalerProcess(Scaler *scaler, const uint32_t *src, uint32_t *dst)
+{
+    switch (scaler->mode)
+    {
+        case SCALER_SCALE2X:
+            ScaleScale2x(src, dst);
+            break;
+        case SCALER_SCALE3X:
+            ScaleScale3x(src, dst);
+            break;
+        case SCALER_XBR_LITE:
+            ScaleXbrLite(src, scaler->yuv, dst);
+            break;
+        default:
+            ScaleNearest(src, dst, scaler->factor);
+            break;
+    }
+}
+
+static int ScalerThread(void *data)
+{
+    Scaler *scaler = data;
+
+    SDL_LockMutex(scaler->lock);
+    while (true)
+    {
+        while (!scaler->quit && !scaler->queue_count)
+            SDL_WaitCondition(scaler->cond, scaler->lock);
+
+        if (scaler->quit)
+            break;
+
+        // Take the oldest queued frame, the slot gets our previous input buffer
+        uint32_t *tmp = scaler->input;
+        scaler->input = scaler->queue[scaler->queue_head];
+        scaler->queue[scaler->queue_head] = tmp;
+        scaler->queue_head = (scaler->queue_head + 1) % SCALER_QUEUE_SIZE;
+        --scaler->queue_count;
+        SDL_UnlockMutex(scaler->lock);
+
+        ScalerProcess(scaler, scaler->input, scaler->outputs[0]);
+
+        SDL_LockMutex(scaler->lock);
+        tmp = scaler->outputs[1];
+        scaler->outputs[1] = scaler->outputs[0];
+        scaler->outputs[0] = tmp;
+        ++scaler->frames;
+    }
+    SDL_UnlockMutex(scaler->lock);
+
+    return 0;
+}
+
+// NULL if anything can't be allocated or started
+Scaler *ScalerCreate(ScalerMode mode, int factor)
+{
+    Scaler *scaler = calloc(1, sizeof(*scaler));
+    if (!scaler)
+        return NULL;
+
+    scaler->mode = mode;
+
+    switch (mode)
+    {
+        case SCALER_SCALE2X:
+        case SCALER_XBR_LITE:
+            scaler->factor = 2;
+            break;
+        case SCALER_SCALE3X:
+            scaler->factor = 3;
+            break;
+        default:
+            scaler->mode = SCALER_NEAREST;
+            scaler->factor = MIN(MAX(factor, 1), SCALER_MAX_FACTOR);
+            break;
+    }
+
+    scaler->out_width = SCREEN_WIDTH * scaler->factor;
+    scaler->out_height = SCREEN_HEIGHT * scaler->factor;
+
+    const size_t frame_size = sizeof(uint32_t) * SCREEN_WIDTH * SCREEN_HEIGHT;
+    const size_t output_size = sizeof(uint32_t) * scaler->out_width * scaler->out_height;
+    for (int i = 0; i < SCALER_QUEUE_SIZE; i++)
+        scaler->queue[i] = calloc(1, frame_size);
+    scaler->input = calloc(1, frame_size);
+    scaler->yuv = calloc(1, frame_size);
+    scaler->outputs[0] = calloc(1, output_size);
+    scaler->outputs[1] = calloc(1, output_size);
+
+    scaler->lock = SDL_CreateMutex();
+    scaler->cond = SDL_CreateCondition();
+
+    bool allocated = scaler->input && scaler->yuv && scaler->outputs[0] && scaler->outputs[1]
+                     && scaler->lock && scaler->cond;
+    for (int i = 0; i < SCALER_QUEUE_SIZE; i++)
+        allocated = allocated && scaler->queue[i];
+
+    if (allocated)
+        scaler->thread = SDL_CreateThread(ScalerThread, "nones_scaler", scaler);
+    if (!scaler->thread)
+    {
+        ScalerDestroy(scaler);
+        return NULL;
+    }
+
+    return scaler;
+}
+
+void ScalerDestroy(Scaler *scaler)
+{
+    if (!scaler)
+        return;
+
+    SDL_LockMutex(scaler->lock);
+    scaler->quit = true;
+    SDL_SignalCondition(scaler->cond);
+    SDL_UnlockMutex(scaler->lock);
+
+    SDL_WaitThread(scaler->thread, NULL);
+    SDL_DestroyCondition(scaler->cond);
+    SDL_DestroyMutex(scaler->lock);
+
+    for (int i = 0; i < SCALER_QUEUE_SIZE; i++)
+        free(scaler->queue[i]);
+    free(scaler->input);
+    free(scaler->yuv);
+    free(scaler->outputs[0]);
+    free(scaler->outputs[1]);
+    free(scaler);
+}
+
+// Queue a SCREEN_WIDTH x SCREEN_HEIGHT frame, dropping the oldest queued one if the scaler fell behind
+void ScalerSubmitFrame(Scaler *scaler, const uint32_t *frame)
+{
+    SDL_LockMutex(scaler->lock);
+
+    if (scaler->queue_count == SCALER_QUEUE_SIZE)
+    {
+        scaler->queue_head = (scaler->queue_head + 1) % SCALER_QUEUE_SIZE;
+        --scaler->queue_count;
+        ++scaler->dropped;
+    }
+
+    const int slot = (scaler->queue_head + scaler->queue_count) % SCALER_QUEUE_SIZE;
+    memcpy(scaler->queue[slot], frame, sizeof(uint32_t) * SCREEN_WIDTH * SCREEN_HEIGHT);
+    ++scaler->queue_count;
+
+    SDL_SignalCondition(scaler->cond);
+    SDL_UnlockMutex(scaler->lock);
+}
+
+// Copy the last scaled frame (out_width x out_height), dst_pitch is in bytes
+bool ScalerReadFrame(Scaler *scaler, uint32_t *dst, int dst_pitch)
+{
+    SDL_LockMutex(scaler->lock);
+
+    if (!scaler->frames)
+    {
+        SDL_UnlockMutex(scaler->lock);
+        return false;
+    }
+
+    const size_t row_size = sizeof(uint32_t) * scaler->out_width;
+    for (int y = 0; y < scaler->out_height; y++)
+        memcpy((uint8_t *)dst + y * dst_pitch, &scaler->outputs[1][y * scaler->out_width], row_size);
+
+    SDL_UnlockMutex(scaler->lock);
+
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef SCALER_H
+#define SCALER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <SDL3/SDL.h>
+
+#define SCALER_MAX_FACTOR 4
+// Frames waiting to be scaled, the oldest one is dropped when full
+#define SCALER_QUEUE_SIZE 2
+
+typedef enum
+{
+    SCALER_NONE,
+    SCALER_NEAREST,
+    SCALER_SCALE2X,
+    SCALER_SCALE3X,
+    SCALER_XBR_LITE,
+    SCALER_MODE_COUNT
+} ScalerMode;
+
+typedef struct
+{
+    ScalerMode mode;
+    int factor;
+    int out_width;
+    int out_height;
+
+    // Ring of queued input frames, the slots are swapped with input when popped
+    uint32_t *queue[SCALER_QUEUE_SIZE];
+    int queue_head;
+    int queue_count;
+    // Frame owned by the scaler thread
+    uint32_t *input;
+    // Per pixel luma/chroma of input for xBR edge detection
+    uint32_t *yuv;
+
+    // outputs[0] is written by the scaler thread, outputs[1] is the last finished frame
+    uint32_t *outputs[2];
+    uint64_t frames;
+    uint64_t dropped;
+
+    SDL_Mutex *lock;
+    SDL_Condition *cond;
+    SDL_Thread *thread;
+    bool quit;
+} Scaler;
+
+Scaler *ScalerCreate(ScalerMode mode, int factor);
+void ScalerDestroy(Scaler *scaler);
+void ScalerSubmitFrame(Scaler *scaler, const uint32_t *frame);
+bool ScalerReadFrame(Scaler *scaler, uint32_t *dst, int dst_pitch);
+
+#endif
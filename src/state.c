@@ -0,0 +1,123 @@
+#ifndef _WIN32
+// mkstemp and fdopen
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "state.h"
+
+void StateBytes(State *state, void *data, size_t size)
+{
+    if (state->data && !state->overflow)
+    {
+        if (state->pos + size > state->size)
+        {
+            state->overflow = true;
+        }
+        else if (state->loading)
+        {
+            memcpy(data, &state->data[state->pos], size);
+        }
+        else
+        {
+            memcpy(&state->data[state->pos], data, size);
+        }
+    }
+
+    state->pos += size;
+}
+
+void StateInitHeader(StateHeader *header, uint32_t rom_crc32, size_t size)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+    snprintf(header->core_version, sizeof(header->core_version), "%s", NONES_VERSION);
+    header->state_version = STATE_VERSION;
+    header->rom_crc32 = rom_crc32;
+    header->size = size;
+}
+
+// The size catches struct layout changes nobody bumped STATE_VERSION for
+bool StateCheckHeader(const StateHeader *header, uint32_t rom_crc32, size_t size)
+{
+    StateHeader expected;
+    StateInitHeader(&expected, rom_crc32, size);
+    return !memcmp(header, &expected, sizeof(expected));
+}
+
+// The header and size bytes of data go to a temporary file that is renamed over path, so a
+// reader never sees half a state. 0 on success.
+int StateWriteFile(const char *path, uint32_t rom_crc32, const void *data, size_t size)
+{
+    StateHeader header;
+    StateInitHeader(&header, rom_crc32, size);
+
+    // Every writer gets its own temp file, sessions that all missed the boot cache write the
+    // same path at once and must not truncate or publish each other's
+    char temp_path[STATE_PATH_SIZE + 32];
+#ifdef _WIN32
+    snprintf(temp_path, sizeof(temp_path), "%s.%lu-%lu.tmp", path, GetCurrentProcessId(), GetCurrentThreadId());
+    FILE *file = fopen(temp_path, "wbx");
+#else
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+    const int fd = mkstemp(temp_path);
+    // mkstemp creates it private, other users' sessions may share the cache
+    if (fd >= 0)
+        fchmod(fd, 0644);
+    FILE *file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (fd >= 0 && !file)
+    {
+        close(fd);
+        remove(temp_path);
+    }
+#endif
+    if (!file)
+        return -1;
+
+    const bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data, size, 1, file) == 1;
+    if (fclose(file) || !written)
+    {
+        remove(temp_path);
+        return -1;
+    }
+
+#ifdef _WIN32
+    if (!MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING))
+#else
+    if (rename(temp_path, path))
+#endif
+    {
+        remove(temp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Fills data with a state written by this build for this ROM, 0 on success
+int StateReadFile(const char *path, uint32_t rom_crc32, void *data, size_t size)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return -1;
+
+    StateHeader header;
+    const bool read = fread(&header, sizeof(header), 1, file) == 1 && StateCheckHeader(&header, rom_crc32, size)
+                      && fread(data, size, 1, file) == 1;
+    fclose(file);
+
+    return read ? 0 : -1;
+}
@@ -0,0 +1,52 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bump whenever what a *StateSync function covers changes
+#define STATE_VERSION 1
+
+// Set by the Makefile
+#ifndef NONES_VERSION
+#define NONES_VERSION "dev"
+#endif
+
+// One pass over the machine state, copying it into data when saving or out of it when loading.
+// Each module lists its state once in a *StateSync function that does both.
+// With data NULL nothing is copied, pos ends up as the size a state needs.
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+    size_t pos;
+    bool loading;
+    // data ran out, nothing past that point was copied
+    bool overflow;
+} State;
+
+// Leads every state file. States are raw copies of the core's structs, they only
+// load into the build that wrote them.
+typedef struct
+{
+    char magic[8];
+    char core_version[24];
+    uint32_t state_version;
+    // CRC32 of the cart's PRG + CHR ROM
+    uint32_t rom_crc32;
+    uint64_t size;
+} StateHeader;
+
+#define STATE_MAGIC "NONESST"
+#define STATE_PATH_SIZE 512
+
+void StateBytes(State *state, void *data, size_t size);
+void StateInitHeader(StateHeader *header, uint32_t rom_crc32, size_t size);
+bool StateCheckHeader(const StateHeader *header, uint32_t rom_crc32, size_t size);
+int StateWriteFile(const char *path, uint32_t rom_crc32, const void *data, size_t size);
+int StateReadFile(const char *path, uint32_t rom_crc32, void *data, size_t size);
+
+#define STATE_FIELD(state, field) StateBytes((state), &(field), sizeof(field))
+
+#endif
@@ -12,12 +12,17 @@
 #include "system.h"
 #include "mapper.h"
 #include "ppu.h"
+#include "state.h"
 #include "utils.h"
 
 static System *system_ptr = NULL;
 
+// NULL if out of memory
 System *SystemCreate(Arena *arena)
 {
+    if (!ArenaReserve(arena, SystemArenaSize()))
+        return NULL;
+
     System *system = ArenaPush(arena, sizeof(System));
     system->cpu = ArenaPush(arena, sizeof(Cpu));
     system->apu = ArenaPush(arena, sizeof(Apu));
@@ -26,21 +31,44 @@ System *SystemCreate(Arena *arena)
     system->joy_pad1 = ArenaPush(arena, sizeof(JoyPad));
     system->joy_pad2 = ArenaPush(arena, sizeof(JoyPad));
     system->sys_ram = ArenaPush(arena, CPU_RAM_SIZE);
+    system->cart_mark = ArenaGetMark(arena);
+
+    // Arena pushes start on a cache line, so the hot span is exactly how many lines each step touches
+    DEBUG_LOG("Layout: Cpu %zu bytes, hot %zu; Ppu %zu bytes, hot %zu of %d lines; Apu %zu bytes, hot %zu of %d lines\n",
+              sizeof(Cpu), FIELD_END(Cpu, irq_pending),
+              sizeof(Ppu), FIELD_END(Ppu, io_bus), PPU_HOT_CACHE_LINES,
+              sizeof(Apu), FIELD_END(Apu, dmc), APU_HOT_CACHE_LINES);
 
     system_ptr = system;
     return system;
 }
 
-int SystemLoadCart(Arena *arena, System *system, const char *path)
+// Exactly what SystemCreate takes from the arena
+size_t SystemArenaSize(void)
+{
+    return ArenaPushSize(sizeof(System)) + ArenaPushSize(sizeof(Cpu)) + ArenaPushSize(sizeof(Apu))
+           + ArenaPushSize(sizeof(Ppu)) + ArenaPushSize(sizeof(Cart)) + ArenaPushSize(sizeof(JoyPad)) * 2
+           + ArenaPushSize(CPU_RAM_SIZE);
+}
+
+// Anything pushed after SystemCreate is dropped along with the previous cart, and the new one
+// starts from cleared RAM
+int SystemLoadCart(Arena *arena, System *system, const char *path, const char *save_path)
 {
-    return CartLoad(arena, system->cart, path);
+    CartUnload(system->cart);
+    ArenaRollback(arena, system->cart_mark);
+    memset(system->sys_ram, 0, CPU_RAM_SIZE);
+    system->fresh = false;
+    return CartLoad(arena, system->cart, path, save_path);
 }
 
 void SystemInit(System *system, uint32_t **buffers)
 {
     PPU_Init(system->ppu, system->cart->mirroring, buffers);
+    PPU_SetA12Watch(system->ppu, system->cart->mapper_num == MAPPER_MMC3);
     APU_Init(system->apu);
     CPU_Init(system->cpu);
+    system->fresh = true;
 }
 
 uint8_t SystemReadOpenBus(void)
@@ -61,6 +89,7 @@ static uint8_t SystemRamRead(System *system, const uint16_t addr)
 static void SWramWrite(System *system, const uint16_t addr, const uint8_t data)
 {
     system->cart->ram[addr & 0x1FFF] = data;
+    system->cart->ram_dirty = true;
 }
 
 static uint8_t SWramRead(System *system, const uint16_t addr)
@@ -263,14 +292,14 @@ uint8_t PpuBusReadChrRom(const uint16_t addr)
 void PpuBusWriteChrRam(const uint16_t addr, const uint8_t data)
 {
     ChrRom *chr_rom = &system_ptr->cart->chr_rom;
-    chr_rom->data[addr & (chr_rom->size - 1)] = data;
+    // Writes to CHR ROM go nowhere
+    if (chr_rom->ram)
+        chr_rom->ram[addr & (chr_rom->size - 1)] = data;
 }
 
+// Only called when the PPU was told the mapper watches A12
 void PpuClockMMC3(void)
 {
-    if (system_ptr->cart->mapper_num != MAPPER_MMC3)
-        return;
-
     Mmc3ClockIrqCounter(system_ptr->cart);
 }
 
@@ -279,6 +308,8 @@ void SystemRun(System *system, SystemState state, bool debug_info)
     if (state == PAUSED)
         return;
 
+    system->fresh = false;
+
     if (state == STEP_FRAME && system->ppu->frame_finished)
     {
         system->ppu->frame_finished = false;
@@ -290,6 +321,9 @@ void SystemRun(System *system, SystemState state, bool debug_info)
     do {
         CPU_Update(system->cpu, debug_info);
     } while (!system->ppu->frame_finished && state != STEP_INSTR);
+
+    if (system->ppu->frame_finished)
+        CartSyncSram(system->cart);
 }
 
 bool SystemPollAllIrqs(void)
@@ -368,4 +402,154 @@ void SystemReset(System *system)
 void SystemShutdown(System *system)
 {
     CartSaveSram(system->cart);
+    CartUnload(system->cart);
+}
+
+static void SystemStateSync(System *system, State *state)
+{
+    CPU_StateSync(system->cpu, state);
+    PPU_StateSync(system->ppu, state);
+    APU_StateSync(system->apu, state);
+    CartStateSync(system->cart, state);
+    MapperStateSync(system->cart, state);
+    StateBytes(state, system->sys_ram, CPU_RAM_SIZE);
+    STATE_FIELD(state, system->bus_data);
+    STATE_FIELD(state, *system->joy_pad1);
+    STATE_FIELD(state, *system->joy_pad2);
+}
+
+// Depends on the loaded cart
+size_t SystemStateSize(System *system)
+{
+    State state = { 0 };
+    SystemStateSync(system, &state);
+    return state.pos;
+}
+
+// 0 on success, size has to be at least SystemStateSize
+int SystemSaveState(System *system, void *data, size_t size)
+{
+    State state = { .data = data, .size = size };
+    SystemStateSync(system, &state);
+    return state.overflow ? -1 : 0;
+}
+
+// Only a state of exactly SystemStateSize bytes is taken, the machine is left alone otherwise
+int SystemLoadState(System *system, const void *data, size_t size)
+{
+    if (size != SystemStateSize(system))
+        return -1;
+
+    State state = { .data = (uint8_t *)data, .size = size, .loading = true };
+    SystemStateSync(system, &state);
+    system->fresh = false;
+    return 0;
+}
+
+int SystemSaveStateFile(System *system, const char *path)
+{
+    const size_t size = SystemStateSize(system);
+    uint8_t *data = malloc(size);
+    if (!data)
+        return -1;
+
+    int result = SystemSaveState(system, data, size);
+    if (!result)
+        result = StateWriteFile(path, system->cart->crc32, data, size);
+
+    free(data);
+    return result;
+}
+
+// States written by another build or for another ROM are refused
+int SystemLoadStateFile(System *system, const char *path)
+{
+    const size_t size = SystemStateSize(system);
+    uint8_t *data = malloc(size);
+    if (!data)
+        return -1;
+
+    int result = StateReadFile(path, system->cart->crc32, data, size);
+    if (!result)
+        result = SystemLoadState(system, data, size);
+
+    free(data);
+    return result;
+}
+
+// Everything a boot depends on besides the ROM
+static uint32_t SystemBootKey(System *system, const SystemBootScript *script)
+{
+    const uint32_t state_version = STATE_VERSION;
+    uint32_t key = CartCrc32(0, NONES_VERSION, strlen(NONES_VERSION));
+    key = CartCrc32(key, &state_version, sizeof(state_version));
+    key = CartCrc32(key, &script->frames, sizeof(script->frames));
+    if (script->buttons)
+        key = CartCrc32(key, script->buttons, script->frames * sizeof(script->buttons[0]));
+    // A game can boot differently depending on its save
+    if (system->cart->battery)
+        key = CartCrc32(key, system->cart->ram, CART_RAM_SIZE);
+    return key;
+}
+
+static void SystemSetPads(System *system, const uint8_t pads[2])
+{
+    // Same order as SystemUpdateJPButtons takes them
+    static const JoypadButton order[8] =
+    {
+        JOYPAD_A, JOYPAD_B, JOYPAD_UP, JOYPAD_DOWN, JOYPAD_LEFT, JOYPAD_RIGHT, JOYPAD_START, JOYPAD_SELECT
+    };
+
+    bool buttons[16];
+    for (int i = 0; i < 16; i++)
+        buttons[i] = pads[i / 8] & order[i % 8];
+    SystemUpdateJPButtons(system, buttons);
+}
+
+static void SystemRunBootScript(System *system, const SystemBootScript *script)
+{
+    // Nobody listens to the boot, only the CPU visible part of the APU has to run
+    const bool audio_enabled = system->apu->audio_enabled;
+    APU_SetAudioEnabled(system->apu, false);
+
+    const uint8_t released[2] = { 0, 0 };
+    for (int frame = 0; frame < script->frames; frame++)
+    {
+        SystemSetPads(system, script->buttons ? script->buttons[frame] : released);
+        SystemRun(system, RUNNING, false);
+    }
+    SystemSetPads(system, released);
+
+    APU_SetAudioEnabled(system->apu, audio_enabled);
+}
+
+// Takes a machine fresh from SystemInit to where the boot script leaves it. When this ROM, script
+// and core ran before the state comes from cache_dir, otherwise the script runs and the result is
+// stored there. 1 when it came from the cache, 0 when it was run, -1 if the machine already ran
+// since SystemInit, a boot from there would be cached under the wrong key.
+int SystemBoot(System *system, const SystemBootScript *script, const char *cache_dir)
+{
+    if (!system->fresh)
+        return -1;
+
+    const size_t size = SystemStateSize(system);
+    uint8_t *data = malloc(size);
+
+    char path[STATE_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/%08X-%08X.boot", cache_dir, system->cart->crc32, SystemBootKey(system, script));
+
+    if (data && !StateReadFile(path, system->cart->crc32, data, size) && !SystemLoadState(system, data, size))
+    {
+        free(data);
+        return 1;
+    }
+
+    SystemRunBootScript(system, script);
+
+    // Not being able to cache it only costs the next session the boot
+    if (data && !SystemSaveState(system, data, size))
+        StateWriteFile(path, system->cart->crc32, data, size);
+
+    free(data);
+    return 0;
 }
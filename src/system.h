@@ -21,6 +21,14 @@ typedef enum
     STEP_FRAME
 } SystemState;
 
+// Input replayed from power on before a session takes over, see SystemBoot
+typedef struct
+{
+    int frames;
+    // Pad 1 and pad 2 buttons (JoypadButton bits) held during each frame, NULL for none
+    const uint8_t (*buttons)[2];
+} SystemBootScript;
+
 typedef struct System
 {
     Cpu *cpu;
@@ -32,12 +40,17 @@ typedef struct System
     JoyPad *joy_pad2;
     uint8_t *sys_ram;
     uint8_t bus_data;
+    // Set by SystemInit, cleared once the machine runs or a state is loaded
+    bool fresh;
+    // End of the system's own allocations, a cart's come after it
+    ArenaMark cart_mark;
 } System;
 
 #define CPU_RAM_SIZE 0x800
 //#define DISABLE_CYCLE_ACCURACY
 
 System *SystemCreate(Arena *arena);
+size_t SystemArenaSize(void);
 void SystemInit(System *system, uint32_t **buffers);
 void SystemRun(System *system, SystemState state, bool debug_info);
 void SystemSync(uint64_t cycles);
@@ -49,10 +62,17 @@ bool SystemPollAllIrqs(void);
 void SystemReset(System *system);
 void SystemShutdown(System *system);
 
+size_t SystemStateSize(System *system);
+int SystemSaveState(System *system, void *data, size_t size);
+int SystemLoadState(System *system, const void *data, size_t size);
+int SystemSaveStateFile(System *system, const char *path);
+int SystemLoadStateFile(System *system, const char *path);
+int SystemBoot(System *system, const SystemBootScript *script, const char *cache_dir);
+
 uint8_t SystemReadOpenBus(void);
 uint8_t BusRead(const uint16_t addr);
 void BusWrite(const uint16_t addr, const uint8_t data);
-int SystemLoadCart(Arena *arena, System *System, const char *path);
+int SystemLoadCart(Arena *arena, System *System, const char *path, const char *save_path);
 
 uint8_t PpuBusReadChrRom(const uint16_t addr);
 void PpuBusWriteChrRam(const uint16_t addr, const uint8_t data);
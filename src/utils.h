@@ -19,6 +19,10 @@ do { fprintf(stdout, fmt, __VA_ARGS__); } while (0)
 
 #define ARRAY_SIZE(s) (sizeof(s) / sizeof((s)[0]))
 
+#define CACHE_LINE_SIZE 64
+// Byte offset just past a struct field, needs <stddef.h>
+#define FIELD_END(type, field) (offsetof(type, field) + sizeof(((type *)0)->field))
+
 #define GET_HIGH_LE(v) (((v >> 8) & 0xFF))
 #define GET_LOW_LE(v) ((v & 0xFF))
 